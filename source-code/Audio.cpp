@@ -0,0 +1,133 @@
+#include "Audio.hpp"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+AudioRing::AudioRing(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    buffer.resize(size);
+    mask = size - 1;
+}
+
+size_t AudioRing::Write(const int16_t* samples, size_t count)
+{
+    size_t h = head.load(memory_order_relaxed);
+    size_t t = tail.load(memory_order_acquire); // The consumer is done with everything before t
+
+    count = min(count, buffer.size() - (h - t));
+
+    // At most two copies: up to the end of the buffer, then from its start
+    size_t first = min(count, buffer.size() - (h & mask));
+    memcpy(&buffer[h & mask], samples, first * sizeof(int16_t));
+    memcpy(&buffer[0], samples + first, (count - first) * sizeof(int16_t));
+
+    head.store(h + count, memory_order_release); // Publishes the samples
+    return count;
+}
+
+size_t AudioRing::Read(int16_t* samples, size_t count)
+{
+    size_t t = tail.load(memory_order_relaxed);
+    size_t h = head.load(memory_order_acquire); // Everything before h is written
+
+    count = min(count, h - t);
+
+    size_t first = min(count, buffer.size() - (t & mask));
+    memcpy(samples, &buffer[t & mask], first * sizeof(int16_t));
+    memcpy(samples + first, &buffer[0], (count - first) * sizeof(int16_t));
+
+    tail.store(t + count, memory_order_release); // Hands the space back
+    return count;
+}
+
+size_t AudioRing::Size() const
+{
+    size_t t = tail.load(memory_order_acquire);
+    return head.load(memory_order_acquire) - t;
+}
+
+Audio::Audio(unsigned int sampleRate, unsigned int frameRate, unsigned int maxLatencyFrames)
+: sampleRate(max(sampleRate, 1u)), frameRate(max(frameRate, 1u)),
+  ring(static_cast<size_t>(max(maxLatencyFrames, 1u)) * this->sampleRate / this->frameRate + 1),
+  maxQueued(static_cast<size_t>(max(maxLatencyFrames, 1u)) * this->sampleRate / this->frameRate)
+{
+    // Start half full of silence, so the first frames late from the emulator do not underrun
+    vector<int16_t> silence(maxQueued / 2);
+    ring.Write(silence.data(), silence.size());
+}
+
+void Audio::Generate(const Chip8& chip8)
+{
+    // Whole samples of this frame, the fraction carries over to the next one
+    remainder += sampleRate;
+    size_t count = remainder / frameRate;
+    remainder %= frameRate;
+
+    frame.resize(count);
+
+    if (chip8.soundTimer > 0)
+    {
+        // Pattern bits per output sample
+        double step = chip8.AudioSampleRate() / sampleRate;
+        const unsigned int bits = sizeof(chip8.audioPattern) * 8;
+
+        for (int16_t& sample : frame)
+        {
+            unsigned int bit = static_cast<unsigned int>(phase);
+            bool on = (chip8.audioPattern[bit >> 3] >> (7 - (bit & 7u))) & 1u;
+            sample = on ? volume : -volume;
+
+            phase += step;
+            if (phase >= bits)
+            {
+                phase -= bits * static_cast<unsigned int>(phase / bits);
+            }
+        }
+    }
+    else
+    {
+        // Every beep starts at the beginning of the pattern
+        fill(frame.begin(), frame.end(), 0);
+        phase = 0;
+    }
+
+    // Keep the latency bounded: what does not fit is dropped rather than queued behind a slow consumer
+    size_t queued = ring.Size();
+    size_t room = queued < maxQueued ? maxQueued - queued : 0;
+    size_t written = ring.Write(frame.data(), min(count, room));
+    droppedSamples += count - written;
+}
+
+void Audio::Fill(int16_t* out, size_t count)
+{
+    size_t queued = ring.Size();
+    queuedAtCallback.store(queued, memory_order_relaxed);
+    if (queued > maxQueuedAtCallback.load(memory_order_relaxed))
+    {
+        maxQueuedAtCallback.store(queued, memory_order_relaxed); // Only this thread writes it
+    }
+
+    size_t got = ring.Read(out, count);
+    if (got < count)
+    {
+        // The emulator fell behind, play silence rather than wait for it
+        memset(out + got, 0, (count - got) * sizeof(int16_t));
+        underruns.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+Audio::Stats Audio::GetStats() const
+{
+    Stats stats;
+    stats.underruns = underruns.load(memory_order_relaxed);
+    stats.droppedSamples = droppedSamples;
+    stats.latencyMs = 1000.0 * queuedAtCallback.load(memory_order_relaxed) / sampleRate;
+    stats.maxLatencyMs = 1000.0 * maxQueuedAtCallback.load(memory_order_relaxed) / sampleRate;
+    return stats;
+}
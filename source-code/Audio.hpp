@@ -0,0 +1,75 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Chip8.hpp"
+using namespace std;
+
+// Single-producer, single-consumer queue of 16-bit samples. One thread only ever writes and one only ever reads,
+// so the two positions are plain atomics and neither side ever takes a lock or waits for the other.
+class AudioRing
+{
+public:
+    explicit AudioRing(size_t capacity); // Rounded up to a power of two
+
+    size_t Write(const int16_t* samples, size_t count); // Producer: queue up to count samples, returns how many fitted
+    size_t Read(int16_t* samples, size_t count); // Consumer: take up to count samples, returns how many there were
+    size_t Size() const; // Samples queued, exact on either side, a lower or upper bound elsewhere
+    size_t Capacity() const { return buffer.size(); }
+
+private:
+    vector<int16_t> buffer;
+    size_t mask; // Capacity - 1, positions wrap with it
+
+    // Free-running positions, on separate cache lines so the two threads do not fight over one line
+    alignas(64) atomic<size_t> head{}; // Next sample written, stored only by the producer
+    alignas(64) atomic<size_t> tail{}; // Next sample read, stored only by the consumer
+};
+
+// The sound of one Chip8, generated on the emulation thread and played by the audio thread.
+// Generate() runs once per emulated frame: while the sound timer is set it plays audioPattern at the machine's
+// pitch (a square wave unless an XO-CHIP ROM loaded its own pattern), otherwise silence.
+// Fill() is the audio callback's side. Both are wait-free; the queue between them is kept between empty
+// (underruns are padded with silence) and maxLatencyFrames (newer samples are dropped), so a stalled side costs
+// the other nothing but a glitch.
+class Audio
+{
+public:
+    struct Stats{
+        uint64_t underruns{}; // Callbacks that found fewer samples than they needed
+        uint64_t droppedSamples{}; // Samples thrown away because the queue was full
+        double latencyMs{}; // Queued audio when the last callback ran
+        double maxLatencyMs{}; // Highest queued audio seen by any callback
+    };
+
+    Audio(unsigned int sampleRate = 48000, unsigned int frameRate = 60, unsigned int maxLatencyFrames = 4);
+
+    void Generate(const Chip8& chip8); // Emulation thread: queue one frame of samples for chip8's current state
+    void Fill(int16_t* out, size_t count); // Audio thread: take count samples, padding with silence on underrun
+
+    Stats GetStats() const; // Emulation thread
+
+    const unsigned int sampleRate;
+    const unsigned int frameRate;
+    int16_t volume{4000}; // Amplitude of the wave
+
+private:
+    AudioRing ring;
+    size_t maxQueued; // Samples queued at most, maxLatencyFrames frames' worth
+
+    // Emulation thread only
+    unsigned int remainder{}; // Leftover of sampleRate / frameRate, so frames average out to exactly sampleRate
+    double phase{}; // Position in the 128-bit pattern
+    vector<int16_t> frame; // Samples of the frame being generated
+    uint64_t droppedSamples{};
+
+    // Written by the audio thread
+    atomic<uint64_t> underruns{};
+    atomic<size_t> queuedAtCallback{};
+    atomic<size_t> maxQueuedAtCallback{};
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include "Batch.hpp"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+Batch::Batch(ThreadPool& pool, unsigned int sliceLength)
+: sliceLength(max(sliceLength, 1u)), pool(pool)
+{}
+
+size_t Batch::Add(const Chip8& machine, unsigned int cpuHz)
+{
+    machines.push_back(machine);
+    schedulers.emplace_back(cpuHz);
+    return machines.size() - 1;
+}
+
+void Batch::Run(unsigned int slices)
+{
+    // One task per machine: a machine only ever touches its own state, so tasks need no locking
+    pool.ParallelFor(machines.size(), [&](size_t i) {
+        for (unsigned int s = 0; s < slices; s++)
+        {
+            schedulers[i].Run(machines[i], sliceLength);
+        }
+    });
+}
+
+Batch::Result Batch::GetResult(size_t machine) const
+{
+    const Chip8& chip8 = machines[machine];
+
+    Result result;
+    result.screenHash = chip8.ScreenHash();
+    memcpy(result.registers, chip8.registers, sizeof(result.registers));
+    result.index = chip8.index;
+    result.pc = chip8.pc;
+    result.cycles = schedulers[machine].cycles;
+    return result;
+}
+
+vector<Batch::Result> Batch::Results() const
+{
+    vector<Result> results(machines.size());
+    pool.ParallelFor(machines.size(), [&](size_t i) {
+        results[i] = GetResult(i);
+    });
+    return results;
+}
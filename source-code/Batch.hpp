@@ -0,0 +1,47 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+#include <vector>
+#include "Chip8.hpp"
+#include "Scheduler.hpp"
+#include "ThreadPool.hpp"
+using namespace std;
+
+// Many independent Chip8 machines stepped together on a ThreadPool.
+// Every machine has its own Scheduler, so timers follow each machine's own emulated time,
+// and a machine's results never depend on how the work was spread over threads.
+class Batch
+{
+public:
+    // What a batch run reports for one machine
+    struct Result{
+        uint64_t screenHash{}; // Chip8::ScreenHash() of the current screen
+        uint8_t registers[16]{}; // V0 to VF
+        uint16_t index{};
+        uint16_t pc{};
+        uint64_t cycles{}; // Instructions executed since the machine was added
+    };
+
+    Batch(ThreadPool& pool, unsigned int sliceLength = 4096);
+
+    // Add a copy of machine running at cpuHz instructions per second, returns its position
+    size_t Add(const Chip8& machine, unsigned int cpuHz = 700);
+
+    // Advance every machine by slices * sliceLength instructions, in parallel
+    void Run(unsigned int slices = 1);
+
+    Result GetResult(size_t machine) const;
+    vector<Result> Results() const; // GetResult for every machine, in order
+
+    size_t Size() const { return machines.size(); }
+
+    vector<Chip8> machines; // Input and state can be changed between runs, e.g. machines[i].keypad
+    vector<Scheduler> schedulers; // schedulers[i] drives machines[i]
+    unsigned int sliceLength; // Instructions per machine per slice
+
+private:
+    ThreadPool& pool;
+};
+
+#endif
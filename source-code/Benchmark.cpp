@@ -0,0 +1,353 @@
+#include "Chip8.hpp"
+#include "Scheduler.hpp"
+#include "Batch.hpp"
+#include "Lockstep.hpp"
+#include "Env.hpp"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <algorithm>
+using namespace std;
+
+// Ways of executing an instruction that the benchmark compares
+enum Dispatch { SWITCH, TABLE, CACHED, JIT };
+
+// Run the emulation cycle with the chosen dispatcher and return the elapsed time in nanoseconds
+template <Dispatch dispatch>
+static double RunCycles(Chip8& chip8, long long cycles)
+{
+    auto start = chrono::high_resolution_clock::now();
+
+    if (dispatch == JIT)
+    {
+        chip8.engine = Chip8::Engine::JIT;
+
+        Scheduler scheduler(0x100 * 60); // A timer tick every 256 instructions, like below
+
+        for(long long i=0; i<cycles; i+=0x1000){
+            // Scripted input, same as below
+            memset(chip8.keypad, 0, sizeof(chip8.keypad));
+            chip8.keypad[(i >> 12) & 0xF] = 1;
+
+            scheduler.Run(chip8, min<long long>(0x1000, cycles - i));
+        }
+    }
+
+    for(long long i=0; i<cycles && dispatch != JIT; i++){
+        // Scripted input: hold a different key every 4096 cycles so input-driven ROMs keep moving
+        if((i & 0xFFF) == 0){
+            memset(chip8.keypad, 0, sizeof(chip8.keypad));
+            chip8.keypad[(i >> 12) & 0xF] = 1;
+        }
+
+        if (dispatch == CACHED)
+        {
+            chip8.Cycle();
+        }
+        else
+        {
+            // Same steps as Chip8::Cycle, decoding every instruction again
+            chip8.opcode = (chip8.memory[chip8.pc] << 8u) | chip8.memory[chip8.pc + 1];
+            chip8.pc += 2;
+
+            if (dispatch == TABLE)
+            {
+                chip8.dissembler();
+            }
+            else
+            {
+                chip8.dissemblerSwitch();
+            }
+        }
+
+        // Timers tick once per 256 instructions
+        if ((i & 0xFF) == 0xFF)
+        {
+            chip8.TickTimers();
+        }
+    }
+
+    auto end = chrono::high_resolution_clock::now();
+    return chrono::duration<double, nano>(end - start).count();
+}
+
+// Compare the visible machine state of two emulators
+static bool SameState(const Chip8& a, const Chip8& b)
+{
+    return memcmp(a.registers, b.registers, sizeof(a.registers)) == 0
+        && memcmp(a.memory, b.memory, sizeof(a.memory)) == 0
+        && memcmp(a.screen, b.screen, sizeof(a.screen)) == 0
+        && a.pc == b.pc && a.index == b.index;
+}
+
+// Run the JIT and the interpreter in lockstep, comparing state after every RunBlock() of the JIT engine
+static bool VerifyJit(const Chip8& start, long long cycles)
+{
+    Chip8 jitChip8 = start;
+    Chip8 interpreterChip8 = start;
+    jitChip8.engine = Chip8::Engine::JIT;
+
+    for(long long i=0; i<cycles; ){
+        // Same scripted input as RunCycles
+        if((i & 0xFFF) == 0){
+            memset(jitChip8.keypad, 0, sizeof(jitChip8.keypad));
+            memset(interpreterChip8.keypad, 0, sizeof(interpreterChip8.keypad));
+            jitChip8.keypad[(i >> 12) & 0xF] = 1;
+            interpreterChip8.keypad[(i >> 12) & 0xF] = 1;
+        }
+
+        uint16_t blockStart = jitChip8.pc;
+
+        // Never cross a timer tick, so both machines see the same timers and input
+        unsigned int executed = jitChip8.RunBlock(0x100 - (i & 0xFF));
+        for(unsigned int j=0; j<executed; j++){
+            interpreterChip8.Cycle();
+        }
+        i += executed;
+
+        if ((i & 0xFF) == 0)
+        {
+            jitChip8.TickTimers();
+            interpreterChip8.TickTimers();
+        }
+
+        if (!SameState(jitChip8, interpreterChip8) || jitChip8.delayTimer != interpreterChip8.delayTimer
+            || jitChip8.soundTimer != interpreterChip8.soundTimer)
+        {
+            cout << "JIT MISMATCH in blocks from 0x" << hex << blockStart << dec << " after " << i << " instructions\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Run copies of start on a Batch and return the elapsed time in nanoseconds, every copy must match a serial run
+static double RunBatch(const Chip8& start, long long cycles, unsigned int& threads, bool& matches)
+{
+    const unsigned int MACHINES = 64;
+    const unsigned int SLICE = 4096;
+    unsigned int slices = max<long long>(cycles / (MACHINES * SLICE), 1);
+
+    ThreadPool pool;
+    Batch batch(pool, SLICE);
+    for(unsigned int i=0; i<MACHINES; i++){
+        batch.Add(start);
+    }
+    threads = pool.Size();
+
+    auto begin = chrono::high_resolution_clock::now();
+    batch.Run(slices);
+    auto end = chrono::high_resolution_clock::now();
+
+    // Same instructions on one machine, one thread
+    Chip8 reference = start;
+    Scheduler scheduler;
+    scheduler.Run(reference, static_cast<uint64_t>(slices) * SLICE);
+
+    matches = true;
+    for(size_t i=0; i<batch.Size(); i++){
+        matches = matches && SameState(batch.machines[i], reference);
+    }
+
+    return chrono::duration<double, nano>(end - begin).count() / (static_cast<double>(slices) * SLICE * MACHINES);
+}
+
+// Run copies of start in lockstep and return the elapsed time per lane-instruction in nanoseconds, every lane must match a serial run
+static double RunLockstep(const Chip8& start, long long cycles, bool& matches)
+{
+    const unsigned int LANES = 64;
+    long long perLane = max<long long>(cycles / LANES, 1);
+
+    Lockstep lockstep(LANES, start, 0x100 * 60);
+
+    auto begin = chrono::high_resolution_clock::now();
+    lockstep.Run(perLane);
+    auto end = chrono::high_resolution_clock::now();
+
+    Chip8 reference = start;
+    Scheduler scheduler(0x100 * 60);
+    scheduler.Run(reference, perLane);
+
+    matches = true;
+    for(size_t i=0; i<lockstep.Size(); i++){
+        Chip8 lane;
+        lockstep.Store(i, lane);
+        matches = matches && SameState(lane, reference);
+    }
+
+    return chrono::duration<double, nano>(end - begin).count() / (static_cast<double>(perLane) * LANES);
+}
+
+// Time restarting a machine that has been playing, with Reset() and by building a new one, in nanoseconds per restart.
+// matches is set when an episode replayed after a Reset() ends exactly like one on a new machine
+static void RunResets(const char* rom, const Chip8& start, double& resetTime, double& constructTime, bool& matches)
+{
+    const int EPISODES = 1000;
+    const unsigned int EPISODE_LENGTH = 0x1000;
+
+    Chip8 chip8 = start;
+    chip8.engine = Chip8::Engine::JIT;
+    Scheduler scheduler(0x100 * 60);
+
+    resetTime = 0;
+    for(int i=0; i<EPISODES; i++){
+        scheduler.Run(chip8, EPISODE_LENGTH);
+
+        auto begin = chrono::high_resolution_clock::now();
+        chip8.Reset();
+        resetTime += chrono::duration<double, nano>(chrono::high_resolution_clock::now() - begin).count();
+    }
+
+    auto begin = chrono::high_resolution_clock::now();
+    for(int i=0; i<EPISODES; i++){
+        Chip8 fresh;
+        fresh.LoadROM(rom);
+    }
+    constructTime = chrono::duration<double, nano>(chrono::high_resolution_clock::now() - begin).count() / EPISODES;
+    resetTime /= EPISODES;
+
+    // The same seeded episode on the reset machine and on a new one
+    Chip8 fresh;
+    fresh.LoadROM(rom);
+    fresh.Seed(1);
+    chip8.Seed(1);
+    Scheduler freshScheduler(0x100 * 60);
+    Scheduler resetScheduler(0x100 * 60);
+    freshScheduler.Run(fresh, EPISODE_LENGTH);
+    resetScheduler.Run(chip8, EPISODE_LENGTH);
+
+    vector<uint8_t> a(Chip8::MAX_STATE_SIZE), b(Chip8::MAX_STATE_SIZE);
+    a.resize(fresh.SaveState(a.data()));
+    b.resize(chip8.SaveState(b.data()));
+    matches = a == b;
+}
+
+// Step 64 environments with scripted actions and return the environment steps per second.
+// matches is set when every thread count gives the same observations, rewards and episode ends
+static double RunEnvs(const char* rom, unsigned int& threads, bool& matches)
+{
+    const unsigned int ENVS = 64;
+    const unsigned int STEPS = 500;
+
+    Env::Config config;
+    config.maxFrames = 600; // Some episodes end, exercising the automatic reset
+    config.reward.push_back(Env::RamValue{0x300, 1}); // Whatever the ROM keeps there, just to exercise the reward path
+
+    ThreadPool pool;
+    ThreadPool serialPool(1);
+    VecEnv envs(pool, ENVS, rom, config);
+    VecEnv serial(serialPool, ENVS, rom, config);
+    threads = pool.Size();
+
+    vector<unsigned int> actions(ENVS);
+    double elapsed = 0;
+    matches = true;
+    for(unsigned int step=0; step<STEPS; step++){
+        for(unsigned int i=0; i<ENVS; i++){
+            actions[i] = (step / 8 + i) % envs[i].ActionCount();
+        }
+
+        auto begin = chrono::high_resolution_clock::now();
+        envs.Step(actions.data());
+        elapsed += chrono::duration<double>(chrono::high_resolution_clock::now() - begin).count();
+
+        serial.Step(actions.data());
+        matches = matches && memcmp(envs.Observations(), serial.Observations(), ENVS * Env::OBSERVATION_WORDS * sizeof(uint64_t)) == 0
+                          && memcmp(envs.Rewards(), serial.Rewards(), ENVS * sizeof(float)) == 0
+                          && memcmp(envs.Dones(), serial.Dones(), ENVS) == 0
+                          && memcmp(envs.Truncations(), serial.Truncations(), ENVS) == 0;
+    }
+
+    return ENVS * STEPS / elapsed;
+}
+
+int main(int inputSize, char** input)
+{
+    // With --verify-jit only the JIT is checked against the interpreter, nothing is timed
+    bool verifyOnly = inputSize > 1 && strcmp(input[1], "--verify-jit") == 0;
+    if (verifyOnly)
+    {
+        input++;
+        inputSize--;
+    }
+
+    if (inputSize < 2 || inputSize > 3)
+    {
+        cout << "FORMAT OF USE: " << input[0] << " [--verify-jit] <ROM> [Cycles]\n";
+        exit(EXIT_FAILURE);
+    }
+
+    char const* ROM = input[1];
+    long long cycles = (inputSize == 3) ? stoll(input[2]) : 10000000;
+
+    // All machines start from identical state, including the random number generator
+    Chip8 switchChip8;
+    switchChip8.LoadROM(ROM);
+    if (verifyOnly)
+    {
+        if (!VerifyJit(switchChip8, cycles))
+        {
+            cout << "in " << ROM << endl;
+            return EXIT_FAILURE;
+        }
+        cout << "JIT matches the interpreter: " << ROM << endl;
+        return 0;
+    }
+    Chip8 tableChip8 = switchChip8;
+    Chip8 cachedChip8 = switchChip8;
+    Chip8 jitChip8 = switchChip8;
+    Chip8 batchChip8 = switchChip8;
+    Chip8 lockstepChip8 = switchChip8;
+    Chip8 resetChip8 = switchChip8;
+
+    if (!VerifyJit(switchChip8, cycles))
+    {
+        return EXIT_FAILURE;
+    }
+
+    double switchTime = RunCycles<SWITCH>(switchChip8, cycles);
+    double tableTime = RunCycles<TABLE>(tableChip8, cycles);
+    double cachedTime = RunCycles<CACHED>(cachedChip8, cycles);
+    double jitTime = RunCycles<JIT>(jitChip8, cycles);
+
+    unsigned int batchThreads;
+    bool batchMatches;
+    double batchTime = RunBatch(batchChip8, cycles, batchThreads, batchMatches);
+
+    bool lockstepMatches;
+    double lockstepTime = RunLockstep(lockstepChip8, cycles, lockstepMatches);
+
+    double resetTime, constructTime;
+    bool resetMatches;
+    RunResets(ROM, resetChip8, resetTime, constructTime, resetMatches);
+
+    unsigned int envThreads;
+    bool envMatches;
+    double envRate = RunEnvs(ROM, envThreads, envMatches);
+
+    cout << "ROM:    " << ROM << "\n";
+    cout << "Cycles: " << cycles << "\n";
+    cout << "switch: " << switchTime / cycles << " ns/instruction\n";
+    cout << "table:  " << tableTime / cycles << " ns/instruction\n";
+    cout << "cached: " << cachedTime / cycles << " ns/instruction\n";
+    cout << "speedup (table):  " << switchTime / tableTime << "x\n";
+    cout << "speedup (cached): " << switchTime / cachedTime << "x\n";
+    cout << "jit:    " << jitTime / cycles << " ns/instruction" << (JitCache::Supported() ? "" : " (not supported, interpreted)") << "\n";
+    cout << "speedup (jit):    " << switchTime / jitTime << "x\n";
+    cout << "batch:  " << batchTime << " ns/instruction over 64 machines on " << batchThreads << " threads\n";
+    cout << "lockstep: " << lockstepTime << " ns/instruction over 64 identical lanes (" << Lockstep::InstructionSet() << ")\n";
+    cout << "env:    " << envRate << " steps/s over 64 environments on " << envThreads << " threads\n";
+    cout << "reset:  " << resetTime << " ns/restart (new machine: " << constructTime << " ns)\n";
+
+    // Every dispatcher must leave the machine in the same state
+    if (!SameState(switchChip8, tableChip8) || !SameState(switchChip8, cachedChip8)
+        || !SameState(switchChip8, jitChip8) || !batchMatches || !lockstepMatches || !resetMatches || !envMatches)
+    {
+        cout << "MISMATCH BETWEEN DISPATCHERS" << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
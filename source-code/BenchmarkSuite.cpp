@@ -0,0 +1,272 @@
+#include "Chip8.hpp"
+#include "Scheduler.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+using namespace std;
+
+const unsigned int CPU_HZ = 660; // 11 instructions per frame, as the headless runner
+const unsigned int TIMER_HZ = 60;
+const unsigned int KEY_PERIOD = 4096; // Scripted input holds a different key every KEY_PERIOD instructions
+
+// Measurements of one ROM on one engine
+struct SuiteResult{
+    string rom;
+    const char* engine;
+    double nsPerInstruction; // Best of the repetitions
+    uint64_t draws; // Dxyn executed in the run
+    double ticksPerDraw; // Host cycle counter ticks (ns without one) per Dxyn, interpreted
+    size_t footprint; // Bytes of the machine and its compiled code at the end of the run
+    size_t stateBytes; // Bytes of a saved state at the end of the run
+    uint64_t screenHash;
+};
+
+// Host cycle counter, nanoseconds where there is none
+static uint64_t Ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static const char* TickUnit()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return "tsc";
+#else
+    return "ns";
+#endif
+}
+
+static void ScriptKeys(Chip8& chip8, uint64_t cycle)
+{
+    memset(chip8.keypad, 0, sizeof(chip8.keypad));
+    chip8.keypad[(cycle / KEY_PERIOD) & 0xF] = 1;
+}
+
+// Fresh machine for a run: same ROM and seed every time, so all engines and repetitions do identical work
+static Chip8 Start(const char* rom, Chip8::Engine engine)
+{
+    Chip8 chip8;
+    chip8.LoadROM(rom);
+    chip8.Seed(0);
+    chip8.engine = engine;
+    return chip8;
+}
+
+// Bytes of a machine, its compiled blocks and its generated code
+static size_t Footprint(const Chip8& chip8)
+{
+    size_t bytes = sizeof(Chip8) + chip8.blocks.capacity() * sizeof(Chip8::Block) + chip8.jit.CodeBytes();
+    for (const Chip8::Block& block : chip8.blocks)
+    {
+        bytes += block.code.capacity() * sizeof(Chip8::Instruction);
+    }
+    return bytes;
+}
+
+// Run instructions with scripted input, returns the elapsed nanoseconds
+static double TimeRun(Chip8& chip8, uint64_t instructions)
+{
+    Scheduler scheduler(CPU_HZ, TIMER_HZ);
+
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < instructions; i += KEY_PERIOD)
+    {
+        ScriptKeys(chip8, i);
+        scheduler.Run(chip8, min<uint64_t>(KEY_PERIOD, instructions - i));
+    }
+    auto end = chrono::steady_clock::now();
+
+    return chrono::duration<double, nano>(end - start).count();
+}
+
+// Interpret the same run one instruction at a time, timing every Dxyn on its own
+static double TimeDraws(const char* rom, uint64_t instructions, uint64_t& draws)
+{
+    Chip8 chip8 = Start(rom, Chip8::Engine::INTERPRETER);
+    Scheduler scheduler(CPU_HZ, TIMER_HZ);
+
+    // Cost of reading the counter itself, taken off every sample
+    uint64_t overhead = ~0ull;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t begin = Ticks();
+        overhead = min(overhead, Ticks() - begin);
+    }
+
+    uint64_t total = 0;
+    draws = 0;
+    for (uint64_t i = 0; i < instructions; i++)
+    {
+        if (i % KEY_PERIOD == 0)
+        {
+            ScriptKeys(chip8, i);
+        }
+
+        if (chip8.pc < 4095 && (chip8.memory[chip8.pc] >> 4) == 0xD)
+        {
+            scheduler.Run(chip8, 0); // Deliver a timer tick due before the draw
+
+            uint64_t begin = Ticks();
+            chip8.Cycle();
+            uint64_t elapsed = Ticks() - begin;
+
+            scheduler.cycles++;
+            total += elapsed > overhead ? elapsed - overhead : 0;
+            draws++;
+        }
+        else
+        {
+            scheduler.Run(chip8, 1);
+        }
+    }
+
+    return draws ? static_cast<double>(total) / draws : 0.0;
+}
+
+static string JsonString(const string& text)
+{
+    string out = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+int main(int inputSize, char** input)
+{
+    uint64_t instructions = 2000000;
+    unsigned int repeat = 3;
+    bool json = false;
+    vector<pair<const char*, Chip8::Engine>> engines = {
+        {"interpreter", Chip8::Engine::INTERPRETER}, {"jit", Chip8::Engine::JIT}};
+    vector<const char*> roms;
+
+    try{
+        for (int i = 1; i < inputSize; i++)
+        {
+            bool hasValue = (i + 1 < inputSize);
+
+            if (strcmp(input[i], "--instructions") == 0 && hasValue) instructions = stoull(input[++i]);
+            else if (strcmp(input[i], "--repeat") == 0 && hasValue) repeat = max(stoi(input[++i]), 1);
+            else if (strcmp(input[i], "--json") == 0) json = true;
+            else if (strcmp(input[i], "--engine") == 0 && hasValue)
+            {
+                string name = input[++i];
+                auto match = find_if(engines.begin(), engines.end(), [&](const pair<const char*, Chip8::Engine>& e) { return name == e.first; });
+                if (match == engines.end()) throw "Unknown engine";
+                engines = {*match};
+            }
+            else if (input[i][0] == '-') throw "Unknown or incomplete option";
+            else roms.push_back(input[i]);
+        }
+
+        if (roms.empty())
+        {
+            cout << "FORMAT OF USE: " << input[0] << " [--instructions N] [--repeat N] [--engine interpreter|jit] [--json] <ROM>...\n";
+            exit(EXIT_FAILURE);
+        }
+
+        vector<SuiteResult> results;
+        bool mismatch = false;
+
+        for (const char* rom : roms)
+        {
+            if (!ifstream(rom, ios::binary).is_open())
+            {
+                throw "Could not open a ROM";
+            }
+
+            // Dxyn is always interpreted, so one measurement serves every engine
+            uint64_t draws;
+            double ticksPerDraw = TimeDraws(rom, instructions, draws);
+            size_t first = results.size();
+
+            for (auto& engine : engines)
+            {
+                SuiteResult result{rom, engine.first, 0.0, draws, ticksPerDraw, 0, 0, 0};
+
+                for (unsigned int r = 0; r < repeat; r++)
+                {
+                    Chip8 chip8 = Start(rom, engine.second);
+                    double ns = TimeRun(chip8, instructions) / instructions;
+
+                    if (r == 0 || ns < result.nsPerInstruction)
+                    {
+                        result.nsPerInstruction = ns;
+                    }
+                    result.footprint = Footprint(chip8);
+                    result.stateBytes = chip8.StateSize();
+                    result.screenHash = chip8.ScreenHash();
+                }
+
+                // Every engine must end on the same screen
+                if (results.size() > first && result.screenHash != results[first].screenHash)
+                {
+                    mismatch = true;
+                }
+                results.push_back(result);
+            }
+        }
+
+        if (json)
+        {
+            cout << "{\n  \"instructions\": " << instructions << ",\n  \"repeat\": " << repeat
+                 << ",\n  \"cpu_hz\": " << CPU_HZ << ",\n  \"tick_unit\": \"" << TickUnit() << "\""
+                 << ",\n  \"sizeof_chip8\": " << sizeof(Chip8) << ",\n  \"max_state_bytes\": " << Chip8::MAX_STATE_SIZE
+                 << ",\n  \"results\": [\n";
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                const SuiteResult& r = results[i];
+                cout << "    {\"rom\": " << JsonString(r.rom) << ", \"engine\": \"" << r.engine << "\""
+                     << ", \"instructions_per_second\": " << fixed << setprecision(0) << 1e9 / r.nsPerInstruction
+                     << ", \"ns_per_instruction\": " << setprecision(3) << r.nsPerInstruction
+                     << ", \"draws\": " << r.draws << ", \"ticks_per_dxyn\": " << setprecision(1) << r.ticksPerDraw
+                     << ", \"footprint_bytes\": " << r.footprint << ", \"state_bytes\": " << r.stateBytes
+                     << ", \"screen_hash\": \"" << hex << setfill('0') << setw(16) << r.screenHash << dec << setfill(' ') << "\"}"
+                     << (i + 1 < results.size() ? ",\n" : "\n");
+            }
+            cout << "  ]\n}\n";
+        }
+        else
+        {
+            cout << left << setw(28) << "ROM" << setw(13) << "engine" << right << setw(14) << "instr/s" << setw(10) << "ns/instr"
+                 << setw(10) << "draws" << setw(10) << TickUnit() << "/Dxyn" << setw(12) << "bytes" << "\n";
+            for (const SuiteResult& r : results)
+            {
+                string name = r.rom.substr(r.rom.find_last_of("/\\") + 1);
+                cout << left << setw(28) << name << setw(13) << r.engine << right << fixed
+                     << setw(14) << setprecision(0) << 1e9 / r.nsPerInstruction << setw(10) << setprecision(2) << r.nsPerInstruction
+                     << setw(10) << r.draws << setw(15) << setprecision(1) << r.ticksPerDraw << setw(12) << r.footprint << "\n";
+            }
+        }
+
+        if (mismatch)
+        {
+            cout << "MISMATCH BETWEEN ENGINES" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const char* e)
+    {
+        cout << "AN ERROR OCCURRED !!!!!!!!!!!!" << endl;
+        cout << e << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
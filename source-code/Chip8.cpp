@@ -4,13 +4,19 @@
 #include <chrono>
 #include <cstdint>
 #include <cstring>
-#include <unordered_map>
+#include <algorithm>
+#include <cmath>
 #include "Chip8.hpp"
+#include "Profiler.hpp"
+#include "Rom.hpp"
 using namespace std;
 
 const unsigned int START_ADDRESS=0x200; // Main code of the program starts at 0x200
 const unsigned int FONTSET_SIZE=80; // Size of Font Set to represent on screen (0-9 and A-F)
 const unsigned int FONTSET_START_ADDRESS=0x50; // Font Set starts at 0x50
+const unsigned int BIG_FONTSET_SIZE=160; // SCHIP 8 x 10 digits, 0-9 and A-F
+const unsigned int BIG_FONTSET_START_ADDRESS=0xA0; // Right after the small font
+const unsigned int JIT_THRESHOLD=16; // Times a block runs before the JIT compiles it
 
 // Fontset to represent 0-9 and A-F on screen
 uint8_t fontset[FONTSET_SIZE]= {
@@ -32,20 +38,257 @@ uint8_t fontset[FONTSET_SIZE]= {
 		0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 	};
 
+// Big font for Fx30, 10 bytes per digit
+uint8_t bigFontset[BIG_FONTSET_SIZE]= {
+		0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+		0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+		0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+		0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+		0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+		0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+		0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+		0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+		0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+		0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+	};
+
+Chip8::Chip8Func Chip8::dispatchTable[QUIRK_PROFILES][0x10000];
+
+// Memory below START_ADDRESS of a machine that was just started: both fonts, zeros everywhere else
+static uint8_t bootImage[START_ADDRESS];
+
+static void BuildBootImage(){
+    memcpy(&bootImage[FONTSET_START_ADDRESS], fontset, FONTSET_SIZE);
+    memcpy(&bootImage[BIG_FONTSET_START_ADDRESS], bigFontset, BIG_FONTSET_SIZE);
+}
+
+// All zeros, to compare memory with the part of the pristine image past the ROM
+static const uint8_t zeroPage[256]{};
+
     Chip8::Chip8()
     : randGen(chrono::system_clock::now().time_since_epoch().count()) // Initializing random number generator
 {
+    static const bool tableBuilt = (BuildDispatchTable<QuirkProfile::MODERN>(), BuildDispatchTable<QuirkProfile::COSMAC_VIP>(),
+                                    BuildDispatchTable<QuirkProfile::SCHIP>(), BuildDispatchTable<QuirkProfile::XO_CHIP>(),
+                                    BuildBootImage(), true); // Built by the first instance only (thread-safe static init)
+    (void)tableBuilt;
+
     pc = START_ADDRESS; // Initializing Program Counter to start address
+    memoryTop = START_ADDRESS; // Nothing but the fonts yet
 
-    for(unsigned int i=0; i<FONTSET_SIZE; i++){
-        memory[FONTSET_START_ADDRESS + i] = fontset[i]; // Loading the FonSet into memory of Chip 8 Emulator
-    }
+    FlushBlocks(); // No blocks compiled yet
+
+    memcpy(memory, bootImage, START_ADDRESS); // Loading the FontSets into memory of Chip 8 Emulator
 
     randByte=uniform_int_distribution<uint8_t>(0, 255); // Initializing random byte generator from 0 to 255
             
 }
 
+template <QuirkProfile P>
+void Chip8::BuildDispatchTable(){
+    Chip8Func* dispatch = dispatchTable[static_cast<unsigned int>(P)];
+
+    // Handlers selected by the first nibble alone
+    const Chip8Func table[16] = {
+        &Handler<&Chip8::OPCODE_NULL>, &Handler<&Chip8::OPCODE_1nnn>, &Handler<&Chip8::OPCODE_2nnn>, &Handler<&Chip8::OPCODE_3xkk<P>>,
+        &Handler<&Chip8::OPCODE_4xkk<P>>, &Handler<&Chip8::OPCODE_5xy0<P>>, &Handler<&Chip8::OPCODE_6xkk>, &Handler<&Chip8::OPCODE_7xkk>,
+        &Handler<&Chip8::OPCODE_NULL>, &Handler<&Chip8::OPCODE_9xy0<P>>, &Handler<&Chip8::OPCODE_ANNN>, &Handler<&Chip8::OPCODE_BNNN<P>>,
+        &Handler<&Chip8::OPCODE_CXKK>, &Handler<&Chip8::OPCODE_Dxyn<P>>, &Handler<&Chip8::OPCODE_NULL>, &Handler<&Chip8::OPCODE_NULL>
+    };
+
+    // 8xyN, selected by the last nibble
+    Chip8Func table8[16];
+    for(auto& func : table8){
+        func = &Handler<&Chip8::OPCODE_NULL>;
+    }
+    table8[0x0] = &Handler<&Chip8::OPCODE_8xy0>;
+    table8[0x1] = &Handler<&Chip8::OPCODE_8xy1<P>>;
+    table8[0x2] = &Handler<&Chip8::OPCODE_8xy2<P>>;
+    table8[0x3] = &Handler<&Chip8::OPCODE_8xy3<P>>;
+    table8[0x4] = &Handler<&Chip8::OPCODE_8xy4>;
+    table8[0x5] = &Handler<&Chip8::OPCODE_8xy5>;
+    table8[0x6] = &Handler<&Chip8::OPCODE_8xy6<P>>;
+    table8[0x7] = &Handler<&Chip8::OPCODE_8xy7>;
+    table8[0xE] = &Handler<&Chip8::OPCODE_8xyE<P>>;
+
+    // ExNN and FxNN, selected by the last byte
+    Chip8Func tableE[256];
+    Chip8Func tableF[256];
+    for(unsigned int i=0; i<256; i++){
+        tableE[i] = &Handler<&Chip8::OPCODE_NULL>;
+        tableF[i] = &Handler<&Chip8::OPCODE_NULL>;
+    }
+    tableE[0x9E] = &Handler<&Chip8::OPCODE_Ex9E<P>>;
+    tableE[0xA1] = &Handler<&Chip8::OPCODE_ExA1<P>>;
+
+    tableF[0x01] = &Handler<&Chip8::OPCODE_Fn01>;
+
+    tableF[0x07] = &Handler<&Chip8::OPCODE_Fx07>;
+    tableF[0x0A] = &Handler<&Chip8::OPCODE_Fx0A>;
+    tableF[0x15] = &Handler<&Chip8::OPCODE_Fx15>;
+    tableF[0x18] = &Handler<&Chip8::OPCODE_Fx18>;
+    tableF[0x1E] = &Handler<&Chip8::OPCODE_Fx1E>;
+    tableF[0x29] = &Handler<&Chip8::OPCODE_Fx29>;
+    tableF[0x30] = &Handler<&Chip8::OPCODE_Fx30>;
+    tableF[0x33] = &Handler<&Chip8::OPCODE_Fx33>;
+    tableF[0x3A] = &Handler<&Chip8::OPCODE_Fx3A>;
+    tableF[0x55] = &Handler<&Chip8::OPCODE_Fx55<P>>;
+    tableF[0x65] = &Handler<&Chip8::OPCODE_Fx65<P>>;
+    tableF[0x75] = &Handler<&Chip8::OPCODE_Fx75>;
+    tableF[0x85] = &Handler<&Chip8::OPCODE_Fx85>;
+
+    // Flatten everything into one entry per opcode so dispatch is a single lookup
+    for(unsigned int op=0; op<0x10000; op++){
+        switch(op >> 12){
+            case 0x0:
+                dispatch[op] = (op == 0x00E0) ? &Handler<&Chip8::OPCODE_00E0>
+                                  : (op == 0x00EE) ? &Handler<&Chip8::OPCODE_00EE>
+                                  : ((op & 0xFFF0u) == 0x00C0) ? &Handler<&Chip8::OPCODE_00Cn>
+                                  : ((op & 0xFFF0u) == 0x00D0) ? &Handler<&Chip8::OPCODE_00Dn>
+                                  : (op == 0x00FB) ? &Handler<&Chip8::OPCODE_00FB>
+                                  : (op == 0x00FC) ? &Handler<&Chip8::OPCODE_00FC>
+                                  : (op == 0x00FD) ? &Handler<&Chip8::OPCODE_00FD>
+                                  : (op == 0x00FE) ? &Handler<&Chip8::OPCODE_00FE>
+                                  : (op == 0x00FF) ? &Handler<&Chip8::OPCODE_00FF>
+                                  : &Handler<&Chip8::OPCODE_NULL>;
+                break;
+            case 0x5:
+                dispatch[op] = ((op & 0x000Fu) == 0x2) ? &Handler<&Chip8::OPCODE_5xy2>
+                                  : ((op & 0x000Fu) == 0x3) ? &Handler<&Chip8::OPCODE_5xy3>
+                                  : table[0x5];
+                break;
+            case 0x8:
+                dispatch[op] = table8[op & 0x000Fu];
+                break;
+            case 0xE:
+                dispatch[op] = tableE[op & 0x00FFu];
+                break;
+            case 0xF:
+                // F000 and F002 share their low byte with no FxNN instruction, but take no register
+                dispatch[op] = (op == 0xF000) ? &Handler<&Chip8::OPCODE_F000>
+                                  : (op == 0xF002) ? &Handler<&Chip8::OPCODE_F002>
+                                  : tableF[op & 0x00FFu];
+                break;
+            default:
+                dispatch[op] = table[op >> 12];
+                break;
+        }
+    }
+}
+
+Chip8::Instruction Chip8::Decode(uint16_t opcode, QuirkProfile profile){
+    Instruction instruction;
+    instruction.handler = dispatchTable[static_cast<unsigned int>(profile)][opcode];
+    instruction.opcode = opcode;
+    instruction.nnn = opcode & 0x0FFFu;
+    instruction.x = (opcode & 0x0F00u) >> 8u;
+    instruction.y = (opcode & 0x00F0u) >> 4u;
+    instruction.n = opcode & 0x000Fu;
+    instruction.kk = opcode & 0x00FFu;
+    return instruction;
+}
+
+bool Chip8::EndsBlock(uint16_t opcode){
+    switch(opcode >> 12){
+        case 0x0: // Return and exit, clearing, scrolling or switching the screen does not end a block
+            return opcode == 0x00EE || opcode == 0x00FD;
+        case 0x1: // Jump
+        case 0x2: // Call
+        case 0x3: // Skips
+        case 0x4:
+        case 0x5: // Including 5xy2, which writes memory
+        case 0x9:
+        case 0xB: // Jump + V0
+        case 0xD: // Draw
+        case 0xE: // Key skips
+            return true;
+        case 0xF: // Key wait, the instructions that write memory, and F000 whose second word is data
+            return (opcode & 0x00FFu) == 0x0A || (opcode & 0x00FFu) == 0x33 || (opcode & 0x00FFu) == 0x55 || opcode == 0xF000;
+        default:
+            return false;
+    }
+}
+
+void Chip8::InvalidateCode(unsigned int address, unsigned int length){
+    // Writes running past the top of memory wrap around to address 0
+    if(address + length > MEMORY_SIZE){
+        InvalidateCode(0, address + length - MEMORY_SIZE);
+        length = MEMORY_SIZE - address;
+    }
+
+    // Nothing past CODE_SIZE is ever cached
+    if(length == 0 || address >= CODE_SIZE){
+        return;
+    }
+
+    // Slot i caches the opcode at memory[2i] and memory[2i + 1], so a byte write hits exactly one slot
+    unsigned int first = address >> 1;
+    unsigned int last = min<unsigned int>(address + length - 1, CODE_SIZE - 1) >> 1;
+
+    for(unsigned int i=first; i<=last; i++){
+        icache[i].handler = nullptr;
+
+        // Blocks are flushed lazily, the writing instruction may still be running out of one
+        if(codeWords[i >> 6] & (1ull << (i & 63))){
+            blocksStale = true;
+        }
+    }
+}
+
+void Chip8::MemoryWritten(unsigned int address, unsigned int length){
+    // A store wrapping around reached the top of memory
+    memoryTop = max<uint32_t>(memoryTop, min(address + length, MEMORY_SIZE));
+    InvalidateCode(address, length);
+}
+
+Chip8::Block& Chip8::CompileBlock(uint16_t address){
+    Block block;
+    block.start = address;
+
+    // Decode until an instruction that ends the block or the end of the cached code
+    for(unsigned int at=address; at + 1 < CODE_SIZE; at+=2){
+        Instruction& cached = icache[at >> 1];
+        if(cached.handler == nullptr){
+            cached = Decode((memory[at] << 8u) | memory[at + 1], quirks);
+        }
+        block.code.push_back(cached);
+
+        codeWords[at >> 7] |= 1ull << ((at >> 1) & 63);
+
+        if(EndsBlock(cached.opcode)){
+            break;
+        }
+    }
+
+    blockAt[address >> 1] = blocks.size();
+    blocks.push_back(move(block));
+    return blocks.back();
+}
+
+void Chip8::FlushBlocks(){
+    blocks.clear();
+    memset(blockAt, 0xFF, sizeof(blockAt));
+    memset(codeWords, 0, sizeof(codeWords));
+    blocksStale = false;
+    jit.Reset();
+}
+
 void Chip8::dissembler(){
+    scratch = Decode(opcode, quirks);
+    op = &scratch;
+    scratch.handler(*this);
+}
+
+void Chip8::dissemblerSwitch(){
+    scratch = Decode(opcode, quirks);
+    op = &scratch;
+
     uint8_t searchNibble = opcode >> 12;
     uint8_t searchN = opcode&0x000Fu;
     uint8_t searchNN = opcode&0x00FFu;
@@ -63,7 +306,37 @@ void Chip8::dissembler(){
                     (*this).OPCODE_00EE();
                     break;
                 }
+                case 0xFB:{
+                    (*this).OPCODE_00FB();
+                    break;
+                }
+                case 0xFC:{
+                    (*this).OPCODE_00FC();
+                    break;
+                }
+                case 0xFD:{
+                    (*this).OPCODE_00FD();
+                    break;
+                }
+                case 0xFE:{
+                    (*this).OPCODE_00FE();
+                    break;
+                }
+                case 0xFF:{
+                    (*this).OPCODE_00FF();
+                    break;
+                }
                 default:{
+                    if ((searchNNN & 0xFF0u) == 0xC0)
+                    {
+                        (*this).OPCODE_00Cn();
+                        break;
+                    }
+                    if ((searchNNN & 0xFF0u) == 0xD0)
+                    {
+                        (*this).OPCODE_00Dn();
+                        break;
+                    }
                     (*this).OPCODE_NULL();
                     break;
                 }
@@ -77,13 +350,23 @@ void Chip8::dissembler(){
             (*this).OPCODE_2nnn();
             break;
         case 0x3:
-            (*this).OPCODE_3xkk();
+            (*this).OPCODE_3xkk<QuirkProfile::MODERN>();
             break;
         case 0x4:
-            (*this).OPCODE_4xkk();
+            (*this).OPCODE_4xkk<QuirkProfile::MODERN>();
             break;
         case 0x5:
-            OPCODE_5xy0();
+            if (searchN == 0x2)
+            {
+                (*this).OPCODE_5xy2();
+                break;
+            }
+            if (searchN == 0x3)
+            {
+                (*this).OPCODE_5xy3();
+                break;
+            }
+            OPCODE_5xy0<QuirkProfile::MODERN>();
             break;
         case 0x6:
             (*this).OPCODE_6xkk();  
@@ -97,13 +380,13 @@ void Chip8::dissembler(){
                     (*this).OPCODE_8xy0();
                     break;
                 case 0x1:
-                    (*this).OPCODE_8xy1();
+                    (*this).OPCODE_8xy1<QuirkProfile::MODERN>();
                     break;
                 case 0x2:
-                    (*this).OPCODE_8xy2();
+                    (*this).OPCODE_8xy2<QuirkProfile::MODERN>();
                     break;
                 case 0x3:
-                    (*this).OPCODE_8xy3();
+                    (*this).OPCODE_8xy3<QuirkProfile::MODERN>();
                     break;
                 case 0x4:
                     (*this).OPCODE_8xy4();
@@ -112,45 +395,58 @@ void Chip8::dissembler(){
                     (*this).OPCODE_8xy5();
                     break;
                 case 0x6:
-                    (*this).OPCODE_8xy6();
+                    (*this).OPCODE_8xy6<QuirkProfile::MODERN>();
                     break;
                 case 0x7:
                     (*this).OPCODE_8xy7();
                     break;
                 case 0xE:
-                    (*this).OPCODE_8xyE();
+                    (*this).OPCODE_8xyE<QuirkProfile::MODERN>();
                     break;
             }
             break;
         }
         case 0x9:
-            (*this).OPCODE_9xy0();
+            (*this).OPCODE_9xy0<QuirkProfile::MODERN>();
             break;
         case 0xA:
             (*this).OPCODE_ANNN();  
             break;
         case 0xB:
-            (*this).OPCODE_BNNN();
+            (*this).OPCODE_BNNN<QuirkProfile::MODERN>();
             break;
         case 0xC:
             (*this).OPCODE_CXKK();
             break;
         case 0xD:
-            (*this).OPCODE_Dxyn();
+            (*this).OPCODE_Dxyn<QuirkProfile::MODERN>();
             break;
         case 0x0E:{
             switch(searchNN){
                 case 0x9E:
-                    (*this).OPCODE_Ex9E();
+                    (*this).OPCODE_Ex9E<QuirkProfile::MODERN>();
                     break;
                 case 0xA1:
-                    (*this).OPCODE_ExA1();
+                    (*this).OPCODE_ExA1<QuirkProfile::MODERN>();
                     break;
             }
             break;
         }
         case 0xF:{
+            if (opcode == 0xF000)
+            {
+                (*this).OPCODE_F000();
+                break;
+            }
+            if (opcode == 0xF002)
+            {
+                (*this).OPCODE_F002();
+                break;
+            }
             switch(searchNN){
+                case 0x01:
+                    (*this).OPCODE_Fn01();
+                    break;
                 case 0x07:
                     (*this).OPCODE_Fx07();
                     break;
@@ -169,14 +465,26 @@ void Chip8::dissembler(){
                 case 0x29:
                     (*this).OPCODE_Fx29();
                     break;
+                case 0x30:
+                    (*this).OPCODE_Fx30();
+                    break;
                 case 0x33:
                     (*this).OPCODE_Fx33();
                     break;
+                case 0x3A:
+                    (*this).OPCODE_Fx3A();
+                    break;
                 case 0x55:
-                    (*this).OPCODE_Fx55();
+                    (*this).OPCODE_Fx55<QuirkProfile::MODERN>();
                     break;
                 case 0x65:
-                    (*this).OPCODE_Fx65();
+                    (*this).OPCODE_Fx65<QuirkProfile::MODERN>();
+                    break;
+                case 0x75:
+                    (*this).OPCODE_Fx75();
+                    break;
+                case 0x85:
+                    (*this).OPCODE_Fx85();
                     break;
             }
             break;
@@ -190,38 +498,368 @@ void Chip8::dissembler(){
 
 //Implementation of Function ROM of CHIP 8 class
 
-void Chip8::LoadROM(char const* filename){
-    // Open the file as a stream of binary and move the file pointer to the end
-    ifstream file(filename, ios::binary | ios::ate);
-
-	
-    if(file.is_open()){
-        // Get size of file and allocate a buffer to hold the contents(contents are in 0's and 1's)
-        streampos size = file.tellg(); // Get size of file
-        char* buffer = new char[size]; // Allocate a buffer to hold contents of file
-
-        // Go back to the beginning of the file and fill the buffer
-        file.seekg(0, ios::beg); // Go to beginning of file
-        file.read(buffer, size); // Read Contens of file in buffer
-        file.close(); // Closing the File
-
-        // Load the ROM contents into the Chip8's memory, starting at 0x200
-        for(long long i=0; i<size; i++){
-            memory[START_ADDRESS + i] = buffer[i]; // Loading the contents from temporary buffer into memory of Chip 8
+// RGBA colour of a pixel by the planes it is on in: none, plane 0, plane 1, both
+const uint32_t PALETTE[1u << PLANES] = {0x00000000, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF};
+
+void Chip8::RenderScreen(uint32_t* pixels) const{
+    // Expand every bit into an RGBA pixel, leftmost pixel first; a low resolution pixel covers 2 x 2
+    for(unsigned int y=0; y<HIRES_HEIGHT; y++){
+        const auto& line = screen[hires ? y : y / 2];
+
+        for(unsigned int x=0; x<HIRES_WIDTH; x++){
+            unsigned int column = hires ? x : x / 2;
+            unsigned int colour = 0;
+            for(unsigned int plane=0; plane<PLANES; plane++){
+                colour |= ((line[plane][column >> 6] >> (63 - (column & 63u))) & 1u) << plane;
+            }
+            pixels[y * HIRES_WIDTH + x] = PALETTE[colour];
+        }
+    }
+}
+
+double Chip8::AudioSampleRate() const{
+    return 4000.0 * pow(2.0, (pitch - 64) / 48.0);
+}
+
+void Chip8::Seed(uint32_t seed){
+    randGen.seed(seed);
+}
+
+void Chip8::Reset(){
+    const uint8_t* romData = rom ? rom->Data() : nullptr;
+    size_t romSize = rom ? rom->Size() : 0;
+
+    // Pristine memory is the fonts, the ROM at START_ADDRESS and zeros after it. Only the code pages that differ
+    // are put back, so a ROM that never rewrote its code keeps its cache and compiled blocks from one episode to
+    // the next; pages from memoryTop up are still all zero and pristine
+    for(unsigned int page=0; page<CODE_SIZE && page<memoryTop; page+=256){
+        if(page < START_ADDRESS){
+            if(memcmp(&memory[page], &bootImage[page], 256) != 0){
+                memcpy(&memory[page], &bootImage[page], 256);
+                InvalidateCode(page, 256);
+            }
+            continue;
         }
 
-        delete[] buffer; // Deleting buffer to release memory
+        size_t offset = page - START_ADDRESS;
+        size_t fromRom = offset < romSize ? min<size_t>(256, romSize - offset) : 0;
+        if((fromRom > 0 && memcmp(&memory[page], romData + offset, fromRom) != 0) || memcmp(&memory[page + fromRom], zeroPage, 256 - fromRom) != 0){
+            if(fromRom > 0){
+                memcpy(&memory[page], romData + offset, fromRom);
+            }
+            memset(&memory[page + fromRom], 0, 256 - fromRom);
+            InvalidateCode(page, 256);
+        }
     }
-};
+
+    // Past CODE_SIZE nothing is cached, the rest of the ROM and zeros go straight back up to memoryTop
+    size_t romEnd = START_ADDRESS + romSize;
+    if(memoryTop > CODE_SIZE){
+        if(romEnd > CODE_SIZE){
+            memcpy(&memory[CODE_SIZE], romData + (CODE_SIZE - START_ADDRESS), romEnd - CODE_SIZE);
+        }
+        size_t zerosFrom = max<size_t>(romEnd, CODE_SIZE);
+        if(memoryTop > zerosFrom){
+            memset(&memory[zerosFrom], 0, memoryTop - zerosFrom);
+        }
+    }
+    memoryTop = romEnd;
+
+    memset(registers, 0, sizeof(registers));
+    index = 0;
+    pc = START_ADDRESS;
+    memset(stack, 0, sizeof(stack));
+    sp = 0;
+    delayTimer = 0;
+    soundTimer = 0;
+    memset(keypad, 0, sizeof(keypad));
+
+    memset(screen, 0, sizeof(screen));
+    hires = false;
+    planes = 1;
+    screenDirty = true;
+    dirtyRows = ~0ull;
+
+    memset(rplFlags, 0, sizeof(rplFlags));
+    memset(audioPattern, 0xF0, sizeof(audioPattern));
+    pitch = 64;
+    opcode = 0;
+    op = nullptr;
+}
+
+void Chip8::SetQuirks(QuirkProfile profile){
+    quirks = profile;
+
+    // Cached instructions and compiled blocks hold the old profile's handlers
+    for(Instruction& cached : icache){
+        cached = Instruction();
+    }
+    FlushBlocks();
+}
+
+uint64_t Chip8::ScreenHash() const{
+    // FNV-1a over the rows, most significant byte (leftmost pixels) first
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    // Low resolution hashes only its 64 x 32 pixels, and planes past the first only once something is on them,
+    // so monochrome screens hash as they did before high resolution and planes existed
+    for(unsigned int plane=0; plane<PLANES; plane++){
+        bool used = plane == 0;
+        for(unsigned int y=0; y<HIRES_HEIGHT && !used; y++){
+            used = (screen[y][plane][0] | screen[y][plane][1]) != 0;
+        }
+        if(!used){
+            continue;
+        }
+
+        for(unsigned int y=0; y<ScreenHeight(); y++){
+            for(unsigned int word=0; word<(hires ? 2u : 1u); word++){
+                for(int shift=56; shift>=0; shift-=8){
+                    hash ^= (screen[y][plane][word] >> shift) & 0xFFu;
+                    hash *= 0x100000001B3ull;
+                }
+            }
+        }
+    }
+
+    return hash;
+}
+
+// Saved state layout, version 4 (version 1 had no high resolution screen or RPL flags, version 2 no XO-CHIP memory,
+// planes or audio, version 3 always held all 64K of memory and every row of both planes). Multi-byte values are
+// little-endian, the screen keeps its packed rows. Memory is the first 4K plus the pages of the XO-CHIP extension up to
+// memoryTop, and the screen only the planes and part of it holding pixels, so a low resolution CHIP-8 or SCHIP state
+// is under 4.5 KB
+const uint8_t STATE_MAGIC[4] = {'C', '8', 'S', 'T'};
+const uint8_t STATE_VERSION = 4;
+const uint8_t FULL_SCREEN = 4; // Screen layout bit: 64 rows of 128 pixels saved, otherwise the 32 rows of 64 of low resolution
+static_assert(is_trivially_copyable<minstd_rand>::value, "the RNG state is saved as raw bytes");
+
+// Size of a state holding extendedPages 256-byte pages past CODE_SIZE and the screen described by layout
+// (bit p set when plane p is saved, plus FULL_SCREEN)
+static constexpr size_t StateSizeFor(unsigned int extendedPages, uint8_t layout){
+    return sizeof(STATE_MAGIC) + 1 // Magic and version
+        + 16 + 1 + CODE_SIZE + extendedPages * 256 + 2 + 2 // Registers, extended page count, memory, index, pc
+        + 16 * 2 + 1 // Stack and stack pointer
+        + 1 + 1 + 2 // Delay timer, sound timer, keypad (bit k set while key k is held)
+        + 1 + 1 + 1 + 2 // Resolution, selected planes, screen layout, current opcode
+        + ((layout & 1u) + ((layout >> 1) & 1u)) * (layout & FULL_SCREEN ? HIRES_HEIGHT * 16 : VIDEO_HEIGHT * 8) // Screen rows
+        + 16 // RPL flags
+        + 16 + 1 // Audio pattern and pitch
+        + sizeof(minstd_rand); // RNG
+}
+
+const size_t Chip8::MAX_STATE_SIZE = StateSizeFor((MEMORY_SIZE - CODE_SIZE) / 256, FULL_SCREEN | 3);
+
+// Pages past CODE_SIZE a state holds, enough to reach memoryTop
+static unsigned int ExtendedPages(uint32_t memoryTop){
+    return memoryTop > CODE_SIZE ? (memoryTop - CODE_SIZE + 255) / 256 : 0;
+}
+
+// Planes holding any pixel, plus FULL_SCREEN when some lie outside the low resolution corner
+static uint8_t ScreenLayout(const uint64_t (&screen)[HIRES_HEIGHT][PLANES][2]){
+    uint8_t layout = 0;
+    for(unsigned int y=0; y<HIRES_HEIGHT; y++){
+        for(unsigned int plane=0; plane<PLANES; plane++){
+            uint64_t left = screen[y][plane][0];
+            uint64_t right = screen[y][plane][1];
+            if(left | right){
+                layout |= 1u << plane;
+            }
+            if(right || (y >= VIDEO_HEIGHT && left)){
+                layout |= FULL_SCREEN;
+            }
+        }
+    }
+    return layout;
+}
+
+size_t Chip8::StateSize() const{
+    return StateSizeFor(ExtendedPages(memoryTop), ScreenLayout(screen));
+}
+
+static uint8_t* Put16(uint8_t* out, uint16_t value){
+    out[0] = value & 0xFFu;
+    out[1] = value >> 8u;
+    return out + 2;
+}
+
+static const uint8_t* Get16(const uint8_t* in, uint16_t& value){
+    value = in[0] | (in[1] << 8u);
+    return in + 2;
+}
+
+size_t Chip8::SaveState(uint8_t* buffer) const{
+    uint8_t* out = buffer;
+
+    memcpy(out, STATE_MAGIC, sizeof(STATE_MAGIC)); out += sizeof(STATE_MAGIC);
+    *out++ = STATE_VERSION;
+
+    memcpy(out, registers, sizeof(registers)); out += sizeof(registers);
+    unsigned int extendedPages = ExtendedPages(memoryTop);
+    *out++ = extendedPages;
+    memcpy(out, memory, CODE_SIZE + extendedPages * 256); out += CODE_SIZE + extendedPages * 256;
+    out = Put16(out, index);
+    out = Put16(out, pc);
+
+    for(uint16_t entry : stack){
+        out = Put16(out, entry);
+    }
+    *out++ = sp;
+
+    *out++ = delayTimer;
+    *out++ = soundTimer;
+
+    uint16_t keys = 0;
+    for(unsigned int k=0; k<16; k++){
+        keys |= (keypad[k] ? 1u : 0u) << k;
+    }
+    out = Put16(out, keys);
+
+    // Rows most significant byte first, the leftmost pixel is the top bit of the first byte
+    *out++ = hires;
+    *out++ = planes;
+    uint8_t layout = ScreenLayout(screen);
+    *out++ = layout;
+    for(unsigned int y=0; y<(layout & FULL_SCREEN ? HIRES_HEIGHT : VIDEO_HEIGHT); y++){
+        for(unsigned int plane=0; plane<PLANES; plane++){
+            if(((layout >> plane) & 1u) == 0){
+                continue;
+            }
+            for(unsigned int word=0; word<(layout & FULL_SCREEN ? 2u : 1u); word++){
+                for(int shift=56; shift>=0; shift-=8){
+                    *out++ = (screen[y][plane][word] >> shift) & 0xFFu;
+                }
+            }
+        }
+    }
+    out = Put16(out, opcode);
+
+    memcpy(out, rplFlags, sizeof(rplFlags)); out += sizeof(rplFlags);
+
+    memcpy(out, audioPattern, sizeof(audioPattern)); out += sizeof(audioPattern);
+    *out++ = pitch;
+
+    memcpy(out, &randGen, sizeof(randGen)); out += sizeof(randGen);
+
+    return out - buffer;
+}
+
+void Chip8::LoadState(const uint8_t* buffer, size_t size){
+    const size_t header = sizeof(STATE_MAGIC) + 1 + sizeof(registers) + 1;
+    if(size < header || memcmp(buffer, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0 || buffer[sizeof(STATE_MAGIC)] != STATE_VERSION){
+        throw "Not a saved state of this version";
+    }
+
+    // The screen layout follows memory and the fixed-size fields after it
+    unsigned int extendedPages = buffer[header - 1];
+    size_t layoutAt = header + CODE_SIZE + extendedPages * 256 + 2 + 2 + 16 * 2 + 1 + 1 + 1 + 2 + 1 + 1;
+    if(extendedPages > (MEMORY_SIZE - CODE_SIZE) / 256 || size <= layoutAt || buffer[layoutAt] > (FULL_SCREEN | 3)
+       || size != StateSizeFor(extendedPages, buffer[layoutAt])){
+        throw "Not a saved state of this version";
+    }
+
+    // Refuse, before touching anything, values no machine can reach: a stack pointer past the full stack or planes
+    // that do not exist. pc and the return addresses are always in range, memory covers every 16-bit address
+    static_assert(MEMORY_SIZE == 0x10000, "every saved pc must be an address in memory");
+    uint8_t savedSp = buffer[header + CODE_SIZE + extendedPages * 256 + 2 + 2 + 16 * 2]; // After index, pc and the stack
+    uint8_t savedPlanes = buffer[layoutAt - 1];
+    if(savedSp > 16 || savedPlanes > (1u << PLANES) - 1){
+        throw "Saved state out of range";
+    }
+
+    const uint8_t* in = buffer + sizeof(STATE_MAGIC) + 1;
+
+    memcpy(registers, in, sizeof(registers)); in += sizeof(registers);
+    in++;
+
+    // Only code in the parts of memory that actually change needs decoding again
+    uint32_t savedTop = CODE_SIZE + extendedPages * 256;
+    for(unsigned int chunk=0; chunk<savedTop; chunk+=64){
+        if(memcmp(&memory[chunk], &in[chunk], 64) != 0){
+            memcpy(&memory[chunk], &in[chunk], 64);
+            InvalidateCode(chunk, 64);
+        }
+    }
+    in += savedTop;
+
+    // Past what the state holds memory is zero, and nothing there is ever cached
+    if(memoryTop > savedTop){
+        memset(&memory[savedTop], 0, memoryTop - savedTop);
+    }
+    memoryTop = savedTop;
+
+    in = Get16(in, index);
+    in = Get16(in, pc);
+
+    for(uint16_t& entry : stack){
+        in = Get16(in, entry);
+    }
+    sp = *in++;
+
+    delayTimer = *in++;
+    soundTimer = *in++;
+
+    uint16_t keys;
+    in = Get16(in, keys);
+    for(unsigned int k=0; k<16; k++){
+        keypad[k] = (keys >> k) & 1u;
+    }
+
+    hires = *in++ != 0;
+    planes = *in++;
+    uint8_t layout = *in++;
+    memset(screen, 0, sizeof(screen));
+    for(unsigned int y=0; y<(layout & FULL_SCREEN ? HIRES_HEIGHT : VIDEO_HEIGHT); y++){
+        for(unsigned int plane=0; plane<PLANES; plane++){
+            if(((layout >> plane) & 1u) == 0){
+                continue;
+            }
+            for(unsigned int word=0; word<(layout & FULL_SCREEN ? 2u : 1u); word++){
+                for(int shift=56; shift>=0; shift-=8){
+                    screen[y][plane][word] |= static_cast<uint64_t>(*in++) << shift;
+                }
+            }
+        }
+    }
+    in = Get16(in, opcode);
+
+    memcpy(rplFlags, in, sizeof(rplFlags)); in += sizeof(rplFlags);
+
+    memcpy(audioPattern, in, sizeof(audioPattern)); in += sizeof(audioPattern);
+    pitch = *in++;
+
+    memcpy(&randGen, in, sizeof(randGen));
+
+    // The whole screen may differ from what the frontend last presented
+    screenDirty = true;
+    dirtyRows = ~0ull;
+}
+
+void Chip8::LoadROM(char const* filename){
+    // Read once per process, every further load of the same file is a copy out of the cache
+    shared_ptr<const Rom> image = RomCache::Get(filename);
+    if(image){
+        LoadROM(image);
+    }
+}
+
+void Chip8::LoadROM(shared_ptr<const Rom> image){
+    // Rom refuses anything bigger than Rom::MAX_SIZE, so the copy stays inside memory
+    memcpy(&memory[START_ADDRESS], image->Data(), image->Size());
+    MemoryWritten(START_ADDRESS, image->Size()); // Previously decoded instructions are stale now
+    rom = move(image);
+}
 
 void Chip8::Cycle(){
-    //Fetching the OpCode of Chip 8 (16 bits)
-    opcode = (memory[pc] << 8u) | memory[pc + 1];
+    Fetch();
 
     pc+=2; // Incrementing Program Counter
 
-    (*this).dissembler();
+    op->handler(*this);
+}
 
+void Chip8::TickTimers(){
 	if (delayTimer > 0)
 	{
 		--delayTimer; // Decrement the delay timer if it's been set
@@ -234,6 +872,128 @@ void Chip8::Cycle(){
 }
 
 
+unsigned int Chip8::Run(unsigned int budget){
+    unsigned int executed = 0;
+
+    if(engine == Engine::JIT){
+        while(executed < budget){
+            executed += RunBlock(budget - executed);
+        }
+    }
+    else if(engine == Engine::PROFILE && profiler != nullptr){
+        executed = Interpret<true>(budget);
+    }
+    else{
+        executed = Interpret<false>(budget);
+    }
+
+    return executed;
+}
+
+template <bool PROFILED>
+unsigned int Chip8::Interpret(unsigned int budget){
+    // Two separate loops: the unprofiled one carries no trace of the profiler
+    for(unsigned int executed = 0; executed < budget; executed++){
+        if constexpr (PROFILED){
+            profiler->Cycle(*this);
+        }
+        else{
+            Cycle();
+        }
+    }
+
+    return budget;
+}
+
+unsigned int Chip8::RunBlock(unsigned int budget){
+    if(budget == 0){
+        return 0;
+    }
+
+    if(blocksStale){
+        FlushBlocks();
+    }
+
+    // Blocks only start at even addresses below CODE_SIZE, anything else is interpreted until pc gets back there
+    if((pc & 1u) != 0 || pc + 1u >= CODE_SIZE){
+        unsigned int executed = 0;
+        do{
+            Cycle();
+            executed++;
+        }while(executed < budget && ((pc & 1u) != 0 || pc + 1u >= CODE_SIZE));
+        return executed;
+    }
+
+    int16_t slot = blockAt[pc >> 1];
+    Block& block = (slot >= 0) ? blocks[slot] : CompileBlock(pc);
+
+    // Compiled blocks run whole, jumping on to the next ones while the budget lasts
+    if(engine == Engine::JIT){
+        unsigned int executed = RunNative(block, budget);
+        if(executed > 0){
+            return executed;
+        }
+    }
+
+    unsigned int count = min<size_t>(budget, block.code.size());
+    const Instruction* code = block.code.data();
+
+    for(unsigned int i=0; i<count; i++){
+        op = &code[i];
+        opcode = op->opcode;
+
+        pc+=2; // Incrementing Program Counter
+
+        op->handler(*this);
+    }
+
+    return count;
+}
+
+unsigned int Chip8::RunNative(Block& block, unsigned int budget){
+    if(block.jitGeneration != jit.generation){
+        block.native = nullptr;
+
+        if(++block.hits < JIT_THRESHOLD){
+            return 0;
+        }
+
+        vector<uint16_t> opcodes;
+        vector<const void*> instructions;
+        for(const Instruction& instruction : block.code){
+            opcodes.push_back(instruction.opcode);
+            instructions.push_back(&instruction); // block.code is never resized, the pointers last as long as the block
+        }
+
+        uint8_t* base = reinterpret_cast<uint8_t*>(this);
+        JitCache::Layout layout;
+        layout.registers = registers - base;
+        layout.index = reinterpret_cast<uint8_t*>(&index) - base;
+        layout.pc = reinterpret_cast<uint8_t*>(&pc) - base;
+        layout.opcode = reinterpret_cast<uint8_t*>(&opcode) - base;
+        layout.delayTimer = &delayTimer - base;
+        layout.stale = reinterpret_cast<uint8_t*>(&blocksStale) - base;
+
+        block.native = jit.Compile(block.start, opcodes.data(), instructions.data(), opcodes.size(), layout, QuirksOf(quirks), &JitFallback);
+        block.jitGeneration = jit.generation;
+    }
+
+    if(block.native == nullptr){
+        return 0;
+    }
+
+    return jit.Run(this, block.native, budget);
+}
+
+void Chip8::JitFallback(void* machine, const void* instruction){
+    Chip8& chip8 = *static_cast<Chip8*>(machine);
+    chip8.op = static_cast<const Instruction*>(instruction);
+    chip8.opcode = chip8.op->opcode;
+
+    chip8.op->handler(chip8);
+}
+
+
 //Implementation of Function Cycle of CHIP 8 class
 
 void Chip8::OPCODE_NULL()
@@ -241,7 +1001,27 @@ void Chip8::OPCODE_NULL()
 
 void Chip8::OPCODE_00E0()
 {
-	memset(screen, 0, sizeof(screen));
+	if (planes == (1u << PLANES) - 1)
+	{
+		memset(screen, 0, sizeof(screen));
+	}
+	else
+	{
+		// Only the selected planes, the others keep their pixels
+		for (auto& line : screen)
+		{
+			for (unsigned int plane = 0; plane < PLANES; plane++)
+			{
+				if (planes & (1u << plane))
+				{
+					line[plane][0] = line[plane][1] = 0;
+				}
+			}
+		}
+	}
+
+	screenDirty = true;
+	dirtyRows = ~0ull;
 }
 
 void Chip8::OPCODE_00EE(){
@@ -249,92 +1029,284 @@ void Chip8::OPCODE_00EE(){
     pc=stack[sp]; // Setting Program Counter to the address at the top of the stack
 }
 
+void Chip8::OPCODE_00Cn()
+{
+	unsigned int rows = op->n;
+	unsigned int height = ScreenHeight();
+
+	// Rows move down, the ones scrolled in at the top are blank
+	if (planes == (1u << PLANES) - 1)
+	{
+		memmove(screen[rows], screen[0], (height - rows) * sizeof(screen[0]));
+		memset(screen[0], 0, rows * sizeof(screen[0]));
+	}
+	else
+	{
+		for (unsigned int plane = 0; plane < PLANES; plane++)
+		{
+			if (!(planes & (1u << plane)))
+			{
+				continue;
+			}
+
+			for (unsigned int y = height; y-- > 0;)
+			{
+				uint64_t* line = screen[y][plane];
+				const uint64_t* from = y >= rows ? screen[y - rows][plane] : nullptr;
+
+				line[0] = from ? from[0] : 0;
+				line[1] = from ? from[1] : 0;
+			}
+		}
+	}
+
+	screenDirty = true;
+	dirtyRows = ~0ull;
+}
+
+void Chip8::OPCODE_00Dn()
+{
+	unsigned int rows = op->n;
+	unsigned int height = ScreenHeight();
+
+	// Rows move up, the ones scrolled in at the bottom are blank
+	if (planes == (1u << PLANES) - 1)
+	{
+		memmove(screen[0], screen[rows], (height - rows) * sizeof(screen[0]));
+		memset(screen[height - rows], 0, rows * sizeof(screen[0]));
+	}
+	else
+	{
+		for (unsigned int plane = 0; plane < PLANES; plane++)
+		{
+			if (!(planes & (1u << plane)))
+			{
+				continue;
+			}
+
+			for (unsigned int y = 0; y < height; y++)
+			{
+				uint64_t* line = screen[y][plane];
+				const uint64_t* from = y + rows < height ? screen[y + rows][plane] : nullptr;
+
+				line[0] = from ? from[0] : 0;
+				line[1] = from ? from[1] : 0;
+			}
+		}
+	}
+
+	screenDirty = true;
+	dirtyRows = ~0ull;
+}
+
+void Chip8::OPCODE_00FB()
+{
+	// Columns 64-127 only exist in high resolution
+	for (unsigned int y = 0; y < ScreenHeight(); y++)
+	{
+		for (unsigned int plane = 0; plane < PLANES; plane++)
+		{
+			if (planes & (1u << plane))
+			{
+				uint64_t* line = screen[y][plane];
+
+				line[1] = hires ? (line[1] >> 4) | (line[0] << 60) : 0;
+				line[0] >>= 4;
+			}
+		}
+	}
+
+	screenDirty = true;
+	dirtyRows = ~0ull;
+}
+
+void Chip8::OPCODE_00FC()
+{
+	for (unsigned int y = 0; y < ScreenHeight(); y++)
+	{
+		for (unsigned int plane = 0; plane < PLANES; plane++)
+		{
+			if (planes & (1u << plane))
+			{
+				uint64_t* line = screen[y][plane];
+
+				line[0] = (line[0] << 4) | (hires ? line[1] >> 60 : 0);
+				line[1] <<= 4;
+			}
+		}
+	}
+
+	screenDirty = true;
+	dirtyRows = ~0ull;
+}
+
+void Chip8::OPCODE_00FD()
+{
+	pc -= 2; // Nothing to return to, so execute this instruction forever
+}
+
+void Chip8::OPCODE_00FE()
+{
+	// Switching resolution clears every plane, selected or not
+	hires = false;
+	memset(screen, 0, sizeof(screen));
+
+	screenDirty = true;
+	dirtyRows = ~0ull;
+}
+
+void Chip8::OPCODE_00FF()
+{
+	hires = true;
+	memset(screen, 0, sizeof(screen));
+
+	screenDirty = true;
+	dirtyRows = ~0ull;
+}
+
 void Chip8::OPCODE_1nnn(){
-    uint16_t address=opcode & 0x0FFFu; // Getting the address from the opcode
+    uint16_t address=op->nnn; // Getting the address from the opcode
     pc=address; // Setting Program Counter to the address
 }
 
 void Chip8::OPCODE_2nnn(){
-    uint16_t address=opcode & 0x0FFFu;
+    uint16_t address=op->nnn;
 
     stack[sp]=pc; // Setting the address of the next instruction to the top of the stack
     sp++; // Incrementing Stack Pointer
     pc=address; // Setting Program Counter to the address of the subroutine
 }
 
+template <QuirkProfile P>
+void Chip8::SkipNext(){
+    // XO-CHIP's F000 nnnn is the only 4-byte instruction, skipping just its first word would run nnnn
+    if constexpr (QuirksOf(P).skipsLongLoad){
+        if(memory[pc] == 0xF0 && memory[(pc + 1) & 0xFFFFu] == 0x00){
+            pc += 2;
+        }
+    }
+
+    pc += 2;
+}
+
+template <QuirkProfile P>
 void Chip8::OPCODE_3xkk(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t byte = opcode & 0x00FFu; // Getting the byte
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t byte = op->kk; // Getting the byte
 
     if(registers[Vx] == byte){
-        pc += 2;
+        SkipNext<P>();
     }
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_4xkk(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t byte = opcode & 0x00FFu; // Getting the byte
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t byte = op->kk; // Getting the byte
 
     if(registers[Vx] != byte){
-        pc += 2;
+        SkipNext<P>();
     }
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_5xy0(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t Vy = (opcode & 0x00F0u) >> 4u; // Getting the Vy
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t Vy = op->y; // Getting the Vy
 
     if(registers[Vx] != registers[Vy]){
-        pc += 2;
+        SkipNext<P>();
+    }
+}
+
+void Chip8::OPCODE_5xy2(){
+    uint8_t Vx = op->x;
+    uint8_t Vy = op->y;
+
+    // Either order, Vx always goes to I; I itself is left alone
+    unsigned int count = (Vx <= Vy ? Vy - Vx : Vx - Vy) + 1;
+    int step = Vx <= Vy ? 1 : -1;
+
+    for(unsigned int i=0; i<count; i++){
+        memory[(index + i) & 0xFFFFu] = registers[Vx + step * static_cast<int>(i)];
+    }
+
+    MemoryWritten(index, count); // The registers may overwrite code
+}
+
+void Chip8::OPCODE_5xy3(){
+    uint8_t Vx = op->x;
+    uint8_t Vy = op->y;
+
+    unsigned int count = (Vx <= Vy ? Vy - Vx : Vx - Vy) + 1;
+    int step = Vx <= Vy ? 1 : -1;
+
+    for(unsigned int i=0; i<count; i++){
+        registers[Vx + step * static_cast<int>(i)] = memory[(index + i) & 0xFFFFu];
     }
 }
 
 void Chip8::OPCODE_6xkk(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t byte = opcode & 0x00FFu; // Getting the byte
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t byte = op->kk; // Getting the byte
 
     registers[Vx] = byte;
 }
 
 void Chip8::OPCODE_7xkk(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t byte = opcode & 0x00FFu; // Getting the byte
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t byte = op->kk; // Getting the byte
 
     registers[Vx] += byte;
 }
 
 void Chip8::OPCODE_8xy0(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t Vy = (opcode & 0x00F0u) >> 4u; // Getting the Vy
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t Vy = op->y; // Getting the Vy
 
     registers[Vx] = registers[Vy];
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_8xy1(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t Vy = (opcode & 0x00F0u) >> 4u; // Getting the Vy
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t Vy = op->y; // Getting the Vy
 
     registers[Vx] |= registers[Vy];
+
+    if constexpr (QuirksOf(P).logicResetsVf){
+        registers[0xF] = 0;
+    }
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_8xy2(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t Vy = (opcode & 0x00F0u) >> 4u; // Getting the Vy
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t Vy = op->y; // Getting the Vy
 
     registers[Vx] &= registers[Vy];
+
+    if constexpr (QuirksOf(P).logicResetsVf){
+        registers[0xF] = 0;
+    }
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_8xy3(){
-    uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-    uint8_t Vy = (opcode & 0x00F0u) >> 4u; // Getting the Vy
+    uint8_t Vx = op->x; // Getting the register Vx
+    uint8_t Vy = op->y; // Getting the Vy
 
     registers[Vx] ^= registers[Vy];
+
+    if constexpr (QuirksOf(P).logicResetsVf){
+        registers[0xF] = 0;
+    }
 }
 
 void Chip8::OPCODE_8xy4()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u; // Getting the register Vx
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u; // Getting the register Vy
+	uint8_t Vx = op->x; // Getting the register Vx
+	uint8_t Vy = op->y; // Getting the register Vy
 
 	uint16_t sum = registers[Vx] + registers[Vy]; // Adding Vx and Vy
 
@@ -352,8 +1324,8 @@ void Chip8::OPCODE_8xy4()
 
 void Chip8::OPCODE_8xy5()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = op->x;
+	uint8_t Vy = op->y;
 
 	if (registers[Vx] > registers[Vy])
 	{
@@ -367,20 +1339,31 @@ void Chip8::OPCODE_8xy5()
 	registers[Vx] -= registers[Vy];
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_8xy6()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = op->x;
 
-	// Save LSB in VF
-	registers[0xF] = (registers[Vx] & 0x1u);
+	if constexpr (QuirksOf(P).shiftReadsVy)
+	{
+		// Vx = Vy >> 1, VF = the bit shifted out, written last
+		uint8_t value = registers[op->y];
+		registers[Vx] = value >> 1;
+		registers[0xF] = value & 0x1u;
+	}
+	else
+	{
+		// Save LSB in VF
+		registers[0xF] = (registers[Vx] & 0x1u);
 
-	registers[Vx] >>= 1;
+		registers[Vx] >>= 1;
+	}
 }
 
 void Chip8::OPCODE_8xy7()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = op->x;
+	uint8_t Vy = op->y;
 
 	if (registers[Vy] > registers[Vx])
 	{
@@ -394,118 +1377,193 @@ void Chip8::OPCODE_8xy7()
 	registers[Vx] = registers[Vy] - registers[Vx];
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_8xyE()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = op->x;
 
-	// Save MSB in VF
-	registers[0xF] = (registers[Vx] & 0x80u) >> 7u;
+	if constexpr (QuirksOf(P).shiftReadsVy)
+	{
+		// Vx = Vy << 1, VF = the bit shifted out, written last
+		uint8_t value = registers[op->y];
+		registers[Vx] = value << 1;
+		registers[0xF] = (value & 0x80u) >> 7u;
+	}
+	else
+	{
+		// Save MSB in VF
+		registers[0xF] = (registers[Vx] & 0x80u) >> 7u;
 
-	registers[Vx] <<= 1;
+		registers[Vx] <<= 1;
+	}
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_9xy0()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = op->x;
+	uint8_t Vy = op->y;
 
 	if (registers[Vx] != registers[Vy])
 	{
-		pc += 2;
+		SkipNext<P>();
 	}
 }
 
 void Chip8::OPCODE_ANNN()
 {
-	uint16_t address = opcode & 0x0FFFu;
+	uint16_t address = op->nnn;
 	index = address;
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_BNNN()
 {
-	uint16_t address = opcode & 0x0FFFu;
+	uint16_t address = op->nnn;
 
-	pc = registers[0] + address;
+	// BXNN adds Vx, the register named by the top nibble of the address
+	pc = registers[QuirksOf(P).jumpUsesVx ? op->x : 0] + address;
 }
 
 void Chip8::OPCODE_CXKK()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = op->x;
+	uint8_t byte = op->kk;
 
 	registers[Vx] = randByte(randGen) & byte;
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_Dxyn()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
-	uint8_t height = opcode & 0x000Fu;
+	uint8_t Vx = op->x;
+	uint8_t Vy = op->y;
+	uint8_t height = op->n;
+	unsigned int width = ScreenWidth();
+	unsigned int screenHeight = ScreenHeight();
+
+	// Dxy0 draws a 16 x 16 sprite of two bytes per row
+	bool big = height == 0;
+	if (big)
+	{
+		height = 16;
+	}
 
 	// Wrap if going beyond screen boundaries
-	uint8_t xPos = registers[Vx] % VIDEO_WIDTH;
-	uint8_t yPos = registers[Vy] % VIDEO_HEIGHT;
+	unsigned int xPos = registers[Vx] % width;
+	unsigned int yPos = registers[Vy] % screenHeight;
 	registers[0xF] = 0;
 
-	for (unsigned int row = 0; row < height; ++row)
+	// Every selected plane draws its own sprite, the one for the next plane follows in memory
+	uint16_t address = index;
+
+	for (unsigned int plane = 0; plane < PLANES; plane++)
 	{
-		uint8_t spriteByte = memory[index + row];
+		if (!(planes & (1u << plane)))
+		{
+			continue;
+		}
 
-		for (unsigned int col = 0; col < 8; ++col)
+		for (unsigned int row = 0; row < height; ++row)
 		{
-			uint8_t spritePixel = spriteByte & (0x80u >> col);
-			uint32_t* screenPixel = &screen[(yPos + row) * VIDEO_WIDTH + (xPos + col)];
+			unsigned int y = yPos + row;
+			uint64_t sprite = big ? static_cast<uint64_t>(memory[static_cast<uint16_t>(address + 2 * row)]) << 56
+			                        | static_cast<uint64_t>(memory[static_cast<uint16_t>(address + 2 * row + 1)]) << 48
+			                      : static_cast<uint64_t>(memory[static_cast<uint16_t>(address + row)]) << 56;
 
-			// Sprite pixel is on
-			if (spritePixel)
+			// Line the sprite up with the row: left covers columns 0-63, right columns 64-127 and,
+			// in low resolution, whatever fell off the right edge
+			uint64_t left = xPos < 64 ? sprite >> xPos : 0;
+			uint64_t right = xPos < 64 ? (xPos ? sprite << (64 - xPos) : 0) : sprite >> (xPos - 64);
+
+			if constexpr (QuirksOf(P).spritesWrap)
+			{
+				// Rows past the bottom come back at the top, columns past the right edge at the left
+				y %= screenHeight;
+				if (hires)
+				{
+					left |= xPos > 64 ? sprite << (128 - xPos) : 0;
+				}
+				else
+				{
+					left |= right;
+					right = 0;
+				}
+			}
+			else
 			{
-				// Screen pixel also on - collision
-				if (*screenPixel == 0xFFFFFFFF)
+				// Clip rows that fall off the bottom of the screen
+				if (y >= screenHeight)
 				{
-					registers[0xF] = 1;
+					break;
 				}
 
-				// Effectively XOR with the sprite pixel
-				*screenPixel ^= 0xFFFFFFFF;
+				// Columns past the right edge are clipped
+				if (!hires)
+				{
+					right = 0;
+				}
+			}
+
+			uint64_t* line = screen[y][plane];
+
+			// Any pixel on in both - collision
+			if ((line[0] & left) | (line[1] & right))
+			{
+				registers[0xF] = 1;
+			}
+
+			line[0] ^= left;
+			line[1] ^= right;
+
+			// An all-zero sprite row leaves the line untouched
+			if (left | right)
+			{
+				screenDirty = true;
+				MarkRowDirty(y);
 			}
 		}
+
+		address += big ? 32 : height;
 	}
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_Ex9E()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = op->x;
 
 	uint8_t key = registers[Vx];
 
 	if (keypad[key])
 	{
-		pc += 2;
+		SkipNext<P>();
 	}
 }
 
+template <QuirkProfile P>
 void Chip8::OPCODE_ExA1()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = op->x;
 
 	uint8_t key = registers[Vx];
 
 	if (!keypad[key])
 	{
-		pc += 2;
+		SkipNext<P>();
 	}
 }
 
 void Chip8::OPCODE_Fx07()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = op->x;
 
 	registers[Vx] = delayTimer;
 }
 
 void Chip8::OPCODE_Fx0A()
 {
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = op->x;
 
 	if (keypad[0])
 	{
@@ -579,60 +1637,126 @@ void Chip8::OPCODE_Fx0A()
 
 void Chip8::OPCODE_Fx15()
 	{
-		uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+		uint8_t Vx = op->x;
 
 		delayTimer = registers[Vx];
 	}
 
 	void Chip8::OPCODE_Fx18()
 	{
-		uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+		uint8_t Vx = op->x;
 
 		soundTimer = registers[Vx];
 	}
 
 	void Chip8::OPCODE_Fx1E()
 	{
-		uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+		uint8_t Vx = op->x;
 
 		index += registers[Vx];
 	}
 
 	void Chip8::OPCODE_Fx29()
 	{
-		uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+		uint8_t Vx = op->x;
 		uint8_t digit = registers[Vx];
 
 		index = FONTSET_START_ADDRESS + (5 * digit);
 	}
 
+	void Chip8::OPCODE_F000()
+	{
+		// The address is the next word, which pc then steps over
+		index = (memory[pc] << 8u) | memory[(pc + 1) & 0xFFFFu];
+		pc += 2;
+	}
+
+	void Chip8::OPCODE_Fn01()
+	{
+		planes = op->x & ((1u << PLANES) - 1);
+	}
+
+	void Chip8::OPCODE_F002()
+	{
+		for (unsigned int i = 0; i < sizeof(audioPattern); i++)
+		{
+			audioPattern[i] = memory[(index + i) & 0xFFFFu];
+		}
+	}
+
+	void Chip8::OPCODE_Fx3A()
+	{
+		uint8_t Vx = op->x;
+
+		pitch = registers[Vx];
+	}
+
+	void Chip8::OPCODE_Fx30()
+	{
+		uint8_t Vx = op->x;
+		uint8_t digit = registers[Vx] & 0xFu;
+
+		index = BIG_FONTSET_START_ADDRESS + (10 * digit);
+	}
+
 	void Chip8::OPCODE_Fx33()
 	{
-		uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+		uint8_t Vx = op->x;
 		uint8_t value = registers[Vx];
 
-		for(int i=0; i<=2; i++){
-			memory[index+i]=value%10;
+		// Hundreds at I, tens at I + 1, ones at I + 2
+		for(int i=2; i>=0; i--){
+			memory[(index + i) & 0xFFFFu] = value % 10;
 			value/=10;
 		}
+
+		MemoryWritten(index, 3); // The digits may overwrite code
 	}
 
+	template <QuirkProfile P>
 	void Chip8::OPCODE_Fx55()
 	{
-		uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+		uint8_t Vx = op->x;
 
 		for (uint8_t i = 0; i <= Vx; ++i)
 		{
-			memory[index + i] = registers[i];
+			memory[(index + i) & 0xFFFFu] = registers[i];
+		}
+
+		MemoryWritten(index, Vx + 1); // The registers may overwrite code
+
+		if constexpr (QuirksOf(P).loadStoreIncrementsI)
+		{
+			index += Vx + 1;
 		}
 	}
 
+	template <QuirkProfile P>
 	void Chip8::OPCODE_Fx65()
 	{
-		uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+		uint8_t Vx = op->x;
 
 		for (uint8_t i = 0; i <= Vx; ++i)
 		{
-			registers[i] = memory[index + i];
+			registers[i] = memory[(index + i) & 0xFFFFu];
+		}
+
+		if constexpr (QuirksOf(P).loadStoreIncrementsI)
+		{
+			index += Vx + 1;
 		}
 	}
+
+	void Chip8::OPCODE_Fx75()
+	{
+		uint8_t Vx = op->x; // SCHIP had 8 flags, later interpreters all 16
+
+		memcpy(rplFlags, registers, Vx + 1);
+	}
+
+	void Chip8::OPCODE_Fx85()
+	{
+		uint8_t Vx = op->x;
+
+		memcpy(registers, rplFlags, Vx + 1);
+	}
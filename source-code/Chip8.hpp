@@ -1,60 +1,161 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
 #include <cstdint>
+#include <memory>
 #include <random>
-#include <unordered_map>
+#include <vector>
+#include "Jit.hpp"
+#include "Quirks.hpp"
 using namespace std;
 
-const unsigned int VIDEO_HEIGHT = 32;
+class Profiler;
+class Rom;
+
+const unsigned int VIDEO_HEIGHT = 32; // Low resolution, the original CHIP-8 screen
 const unsigned int VIDEO_WIDTH = 64;
+const unsigned int HIRES_HEIGHT = 64; // SCHIP high resolution, also the size of every rendered frame
+const unsigned int HIRES_WIDTH = 128;
+const unsigned int PLANES = 2; // XO-CHIP bitplanes, each pixel shows one of 4 colours
+const unsigned int MEMORY_SIZE = 0x10000; // XO-CHIP address space
+const unsigned int CODE_SIZE = 0x1000; // Jumps and calls only reach the first 4K, the only memory whose instructions are cached
 
 class Chip8{
     public:
+        typedef void (*Chip8Func)(Chip8&); // Pointer to an opcode handler
+
+        // An opcode decoded once, with its operands already pulled out of the nibbles
+        struct Instruction{
+            Chip8Func handler{}; // Handler to run, nullptr while the slot has not been decoded
+            uint16_t opcode{}; // Raw 16-bit opcode
+            uint16_t nnn{}; // Lowest 12 bits (address)
+            uint8_t x{}; // Lower 4 bits of the high byte (register Vx)
+            uint8_t y{}; // Upper 4 bits of the low byte (register Vy)
+            uint8_t n{}; // Lowest 4 bits
+            uint8_t kk{}; // Lowest 8 bits (byte)
+        };
+
+        // Straight-line run of decoded instructions, ending in a jump, call, return, skip, draw, key wait or memory write
+        struct Block{
+            uint16_t start{}; // Address of the first instruction
+            vector<Instruction> code; // Instructions in execution order
+
+            uint32_t hits{}; // Times the block was entered, hot blocks get compiled by the JIT
+            uint32_t jitGeneration{}; // JitCache::generation the native code was made for, anything else means not compiled
+            JitCache::NativeBlock native{}; // Native code for the whole block, nullptr if none
+        };
+
+        // Execution engines, all sharing the same registers, memory and screen
+        enum class Engine{
+            INTERPRETER, // One decoded instruction at a time through Cycle()
+            JIT, // Whole basic blocks at a time through RunBlock(), hot blocks compiled to x86-64 code that jumps straight from block to block
+            PROFILE // Like INTERPRETER, timing every instruction into profiler
+        };
+
         Chip8();
-        void LoadROM(const char *filename);
-        void Cycle();
+        void LoadROM(const char *filename); // Load a ROM through RomCache at 0x200, nothing if the file does not exist, throws if it does not fit
+        void LoadROM(shared_ptr<const Rom> image); // Copy an already read ROM image to 0x200 and keep a reference to it
+        void Seed(uint32_t seed); // Restart the random number generator from seed, for reproducible runs
+        void Reset(); // Start over as a new Chip8 with the same ROM, quirks and engine, keeping the random number generator running
+        void SetQuirks(QuirkProfile profile); // Switch to another variant's behaviour, dropping everything decoded for the old one
+        void Cycle(); // Execute one instruction, the timers are left to TickTimers()
+        void Fetch(); // Point op and opcode at the instruction at pc, leaving pc where it is
+        void TickTimers(); // Count the delay and sound timers down by one, called at 60 Hz of emulated time
+        void RenderScreen(uint32_t* pixels) const; // Expand the packed screen into HIRES_WIDTH * HIRES_HEIGHT RGBA pixels, low resolution pixels doubled
+        uint64_t ScreenHash() const; // 64-bit FNV-1a hash of the packed screen, equal screens give equal hashes
+        unsigned int ScreenWidth() const { return hires ? HIRES_WIDTH : VIDEO_WIDTH; } // Current resolution
+        unsigned int ScreenHeight() const { return hires ? HIRES_HEIGHT : VIDEO_HEIGHT; }
+        void MarkRowDirty(unsigned int y) { dirtyRows |= hires ? 1ull << y : 3ull << (2 * y); } // Row y of the current resolution changed
+        double AudioSampleRate() const; // Bits of audioPattern played per second at the current pitch
+
+        static const size_t MAX_STATE_SIZE; // Most bytes SaveState ever writes
+        size_t StateSize() const; // Bytes SaveState writes for the machine as it is now
+        size_t SaveState(uint8_t* buffer) const; // Write the machine state (registers, memory, stack, timers, keypad, screen, RNG) into buffer[MAX_STATE_SIZE], returns StateSize()
+        void LoadState(const uint8_t* buffer, size_t size); // Restore a state written by SaveState, throws on a malformed or foreign state
+        unsigned int Run(unsigned int budget); // Execute up to budget instructions with the selected engine, returns the number executed
+        template <bool PROFILED>
+        unsigned int Interpret(unsigned int budget); // Execute budget instructions through Cycle(), or through profiler when PROFILED
+        unsigned int RunBlock(unsigned int budget); // Execute the block at pc and, when compiled, the compiled blocks after it, at most budget instructions, returns the number executed
+        unsigned int RunNative(Block& block, unsigned int budget); // Run a hot block and the compiled blocks it leads to natively, returns the number of instructions executed, 0 if none
+        static void JitFallback(void* machine, const void* instruction); // Run one Instruction for native code, pc already past it
+
+        static Instruction Decode(uint16_t opcode, QuirkProfile profile); // Split an opcode into its handler for profile and operands
+        static bool EndsBlock(uint16_t opcode); // Whether an opcode may leave straight-line execution or modify memory
+        void InvalidateCode(unsigned int address, unsigned int length); // Drop cached instructions overlapping memory[address, address + length), wrapping at the top of memory
+        void MemoryWritten(unsigned int address, unsigned int length); // memory[address, address + length) was stored to, wrapping at the top: raise memoryTop and invalidate the code there
+        Block& CompileBlock(uint16_t address); // Decode the basic block starting at an even address
+        void FlushBlocks(); // Drop every compiled block
         
         //Functions
 
         void OPCODE_NULL(); // Clear the display
         void OPCODE_00E0(); // Clear the display
         void OPCODE_00EE(); // Return from a subroutine
+        void OPCODE_00Cn(); // Scroll the display down n rows (SCHIP)
+        void OPCODE_00Dn(); // Scroll the display up n rows (XO-CHIP)
+        void OPCODE_00FB(); // Scroll the display right 4 pixels (SCHIP)
+        void OPCODE_00FC(); // Scroll the display left 4 pixels (SCHIP)
+        void OPCODE_00FD(); // Exit the interpreter, here by stopping in place (SCHIP)
+        void OPCODE_00FE(); // Switch to low resolution and clear the display (SCHIP)
+        void OPCODE_00FF(); // Switch to high resolution and clear the display (SCHIP)
         void OPCODE_1nnn(); // Jump to location nnn
         void OPCODE_2nnn(); // Call subroutine at nnn
-        void OPCODE_3xkk(); // Skip next instruction if Vx == kk
-        void OPCODE_4xkk(); // Skip next instruction if Vx != kk
-        void OPCODE_5xy0(); // Skip next instruction if Vx == Vy
+        template <QuirkProfile P> void OPCODE_3xkk(); // Skip next instruction if Vx == kk
+        template <QuirkProfile P> void OPCODE_4xkk(); // Skip next instruction if Vx != kk
+        template <QuirkProfile P> void OPCODE_5xy0(); // Skip next instruction if Vx == Vy
+        void OPCODE_5xy2(); // Store registers Vx through Vy in memory starting at location I (XO-CHIP)
+        void OPCODE_5xy3(); // Read registers Vx through Vy from memory starting at location I (XO-CHIP)
         void OPCODE_6xkk(); // Set Vx = kk
         void OPCODE_7xkk(); // Set Vx = Vx + kk
         void OPCODE_8xy0(); // Set Vx = Vy
-        void OPCODE_8xy1(); // Set Vx = Vx OR Vy
-        void OPCODE_8xy2(); // Set Vx = Vx AND Vy
-        void OPCODE_8xy3(); // Set Vx = Vx XOR Vy
+        template <QuirkProfile P> void OPCODE_8xy1(); // Set Vx = Vx OR Vy
+        template <QuirkProfile P> void OPCODE_8xy2(); // Set Vx = Vx AND Vy
+        template <QuirkProfile P> void OPCODE_8xy3(); // Set Vx = Vx XOR Vy
         void OPCODE_8xy4(); // Set Vx = Vx + Vy, set VF = carry
         void OPCODE_8xy5(); // Set Vx = Vx - Vy, set VF = NOT borrow
-        void OPCODE_8xy6(); // Set Vx = Vx SHR 1
+        template <QuirkProfile P> void OPCODE_8xy6(); // Set Vx = Vx SHR 1
         void OPCODE_8xy7(); // Set Vx = Vy - Vx, set VF = NOT borrow
-        void OPCODE_8xyE(); // Set Vx = Vx SHL 1
-        void OPCODE_9xy0(); // Skip next instruction if Vx != Vy
+        template <QuirkProfile P> void OPCODE_8xyE(); // Set Vx = Vx SHL 1
+        template <QuirkProfile P> void OPCODE_9xy0(); // Skip next instruction if Vx != Vy
         void OPCODE_ANNN(); // Set I = nnn
-        void OPCODE_BNNN(); // Jump to location nnn + V0
+        template <QuirkProfile P> void OPCODE_BNNN(); // Jump to location nnn + V0
         void OPCODE_CXKK(); // Set Vx = random byte AND kk
-        void OPCODE_Dxyn(); // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision
-        void OPCODE_Ex9E(); // Skip next instruction if key with the value of Vx is pressed
-        void OPCODE_ExA1(); // Skip next instruction if key with the value of Vx is not pressed
+        template <QuirkProfile P> void OPCODE_Dxyn(); // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision; Dxy0 draws 16 x 16 (SCHIP)
+        template <QuirkProfile P> void OPCODE_Ex9E(); // Skip next instruction if key with the value of Vx is pressed
+        template <QuirkProfile P> void OPCODE_ExA1(); // Skip next instruction if key with the value of Vx is not pressed
+        void OPCODE_F000(); // Set I = the 16-bit address in the next word, and skip it (XO-CHIP)
+        void OPCODE_Fn01(); // Select the planes n that draws, clears and scrolls affect (XO-CHIP)
+        void OPCODE_F002(); // Load the 16-byte audio pattern from memory starting at location I (XO-CHIP)
         void OPCODE_Fx07(); // Set Vx = delay timer value
         void OPCODE_Fx0A(); // Wait for a key press, store the value of the key in Vx
         void OPCODE_Fx15(); // Set delay timer = Vx
         void OPCODE_Fx18(); // Set sound timer = Vx
         void OPCODE_Fx1E(); // Set I = I + Vx
         void OPCODE_Fx29(); // Set I = location of sprite for digit Vx
+        void OPCODE_Fx30(); // Set I = location of the 10-byte big sprite for digit Vx (SCHIP)
+        void OPCODE_Fx3A(); // Set the audio pitch = Vx (XO-CHIP)
         void OPCODE_Fx33(); // Store BCD representation of Vx in memory locations I, I+1, and I+2
-        void OPCODE_Fx55(); // Store registers V0 through Vx in memory starting at location I
-        void OPCODE_Fx65(); // Read registers V0 through Vx from memory starting at location I
+        template <QuirkProfile P> void OPCODE_Fx55(); // Store registers V0 through Vx in memory starting at location I
+        template <QuirkProfile P> void OPCODE_Fx65(); // Read registers V0 through Vx from memory starting at location I
+        void OPCODE_Fx75(); // Store registers V0 through Vx in the RPL flags (SCHIP)
+        void OPCODE_Fx85(); // Read registers V0 through Vx from the RPL flags (SCHIP)
+
+        void dissembler(); // Dispatch the current opcode through the handler table
+        void dissemblerSwitch(); // Dispatch the current opcode through the nested switch (reference path for benchmarking, MODERN quirks only)
+
+        template <QuirkProfile P>
+        void SkipNext(); // Skip the instruction after the current one, all 4 bytes of an F000 nnnn when P says so
+        template <QuirkProfile P>
+        static void BuildDispatchTable(); // Fill the opcode table of a profile, done once for all instances
+        template <void (Chip8::*Func)()>
+        static void Handler(Chip8& chip8) { (chip8.*Func)(); } // Plain function wrapper so the table holds one direct call per opcode
+        static Chip8Func dispatchTable[QUIRK_PROFILES][0x10000]; // Handler for every possible 16-bit opcode, per profile
 
-        void dissembler();
         //////////////////////////////////////////////Components Of Chip 8 Emulator//////////////////////////////////////////
 
         uint8_t registers[16]{}; // 16 8-bit registers
-        uint8_t memory[4096]{}; // 4K memory
+        uint8_t memory[MEMORY_SIZE]{}; // 64K memory, the original 4K plus the XO-CHIP extension
+        uint32_t memoryTop{}; // memory[memoryTop, MEMORY_SIZE) is all zero, saved states stop there; raise it after writing memory directly
         uint16_t index{}; // Index register
         uint16_t pc{}; // Program counter
         uint16_t stack[16]{}; // Stack for order of execution of calls
@@ -62,117 +163,57 @@ class Chip8{
         uint8_t delayTimer{}; // Delay timer
         uint8_t soundTimer{}; // Sound timer
         uint8_t keypad[16]{}; // Hexadecimal Keypad for user control
-        uint32_t screen[64 * 32]{}; // Display screen of 64 pixels x 32 pixels
+        // Display, one bit per pixel and plane: row y of plane p is screen[y][p][0] (columns 0-63, bit 63 leftmost) followed by
+        // screen[y][p][1] (columns 64-127), so every plane of a row shares one cache line. Low resolution only uses rows 0..31
+        // and word 0, and plane 0 alone is the monochrome screen of the earlier variants
+        uint64_t screen[HIRES_HEIGHT][PLANES][2]{};
+        bool hires{}; // SCHIP 128 x 64 mode, otherwise 64 x 32
+        uint8_t planes{1}; // Bit p set when draws, clears and scrolls affect plane p (XO-CHIP)
+        bool screenDirty{true}; // Screen changed since the frontend last presented it
+        uint64_t dirtyRows{~0ull}; // Bit y set when row y of the rendered frame changed since the frontend last presented it
+        uint8_t rplFlags[16]{}; // SCHIP RPL user flags, written by Fx75 and read by Fx85
+        uint8_t audioPattern[16]{0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0}; // XO-CHIP 1-bit sample loop, most significant bit first, a square wave until F002
+        uint8_t pitch{64}; // XO-CHIP Fx3A pitch, 64 plays the pattern at 4000 bits per second
         uint16_t opcode{}; // Current OpCode of the program
+        const Instruction* op{}; // Decoded form of the current OpCode, read by the OPCODE_ handlers
+
+        Instruction icache[CODE_SIZE / 2]{}; // Decoded instruction for every even address below CODE_SIZE
+        Instruction scratch{}; // Decoded instruction for a pc the cache does not cover (odd or out of range)
+
+        Engine engine{Engine::INTERPRETER}; // Engine used by Run(), can be switched at any time
+        vector<Block> blocks; // Compiled basic blocks
+        int16_t blockAt[CODE_SIZE / 2]; // Index into blocks for every even address, -1 if none starts there
+        uint64_t codeWords[CODE_SIZE / 128]{}; // Bit i % 64 of codeWords[i / 64] set when a block covers memory[2i, 2i + 2), data stored next to code flushes nothing
+        bool blocksStale{}; // Code pages were written, flush blocks before running the next one
+        JitCache jit; // Native code for hot blocks when engine is JIT
+        Profiler* profiler{}; // Receives the timings when engine is PROFILE, not owned
+        QuirkProfile quirks{QuirkProfile::MODERN}; // Variant being emulated, changed through SetQuirks()
+        shared_ptr<const Rom> rom; // ROM last loaded, shared read-only with every other machine running it
 
         //Initializing Variables
-        default_random_engine randGen; // Random number generator
+        minstd_rand randGen; // Random number generator, a fixed engine so saved states restore the same sequence
         uniform_int_distribution<uint8_t> randByte; // Random byte
 
 
 };
 
-    // //UNORDERED_MAP
-    
-    //     table={{0x0, &Chip8::OPCODE_0},
-    //         {0x1, &Chip8::OPCODE_1nnn},
-    //         {0x2, &Chip8::OPCODE_2nnn},
-    //         {0x3, &Chip8::OPCODE_3xkk},
-    //         {0x4, &Chip8::OPCODE_4xkk},
-    //         {0x5, &Chip8::OPCODE_5xy0},
-    //         {0x6, &Chip8::OPCODE_6xkk},
-    //         {0x7, &Chip8::OPCODE_7xkk},
-    //         {0x8, &Chip8::OPCODE_8},
-    //         {0x9, &Chip8::OPCODE_9xy0},
-    //         {0xA, &Chip8::OPCODE_ANNN},
-    //         {0xB, &Chip8::OPCODE_BNNN},
-    //         {0xC, &Chip8::OPCODE_CXKK},
-    //         {0xD, &Chip8::OPCODE_Dxyn},
-    //         {0xE, &Chip8::OPCODE_E},
-    //         {0xF, &Chip8::OPCODE_F}};
-
-    //     table0={
-    //         {0x0, &Chip8::OPCODE_00E0},
-    //         {0xE, &Chip8::OPCODE_00EE}
-    //     };
-
-    //     table8={
-    //         {0x0, &Chip8::OPCODE_8xy0},
-    //         {0x1, &Chip8::OPCODE_8xy1},
-    //         {0x2, &Chip8::OPCODE_8xy2},
-    //         {0x3, &Chip8::OPCODE_8xy3},
-    //         {0x4, &Chip8::OPCODE_8xy4},
-    //         {0x5, &Chip8::OPCODE_8xy5},
-    //         {0x6, &Chip8::OPCODE_8xy6},
-    //         {0x7, &Chip8::OPCODE_8xy7},
-    //         {0xE, &Chip8::OPCODE_8xyE}
-    //     };
-
-    //     tableE={
-    //         {0x1, &Chip8::OPCODE_ExA1},
-    //         {0xE, &Chip8::OPCODE_Ex9E}
-    //     };
-
-    //     tableF={
-    //         {0x07, &Chip8::OPCODE_Fx07},
-    //         {0x0A, &Chip8::OPCODE_Fx0A},
-    //         {0x15, &Chip8::OPCODE_Fx15},
-    //         {0x18, &Chip8::OPCODE_Fx18},
-    //         {0x1E, &Chip8::OPCODE_Fx1E},
-    //         {0x29, &Chip8::OPCODE_Fx29},
-    //         {0x33, &Chip8::OPCODE_Fx33},
-    //         {0x55, &Chip8::OPCODE_Fx55},
-    //         {0x65, &Chip8::OPCODE_Fx65}
-    //     };
-        // unordered_map<uint8_t, Chip8Func> table;
-
-        // unordered_map<uint8_t, Chip8Func> table0;
-
-        // unordered_map<uint8_t, Chip8Func> table8;
-
-        // unordered_map<uint8_t, Chip8Func> tableE;
-
-        // unordered_map<uint8_t, Chip8Func> tableF;
-
-        // table.insert({0x0, &Chip8::OPCODE_0});
-        // table.insert({0x1, &Chip8::OPCODE_1nnn});
-        // table.insert({0x2, &Chip8::OPCODE_2nnn});
-        // table.insert({0x3, &Chip8::OPCODE_3xkk});
-        // table.insert({0x4, &Chip8::OPCODE_4xkk});
-        // table.insert({0x5, &Chip8::OPCODE_5xy0});
-        // table.insert({0x6, &Chip8::OPCODE_6xkk});
-        // table.insert({0x7, &Chip8::OPCODE_7xkk});
-        // table.insert({0x8, &Chip8::OPCODE_8});
-        // table.insert({0x9, &Chip8::OPCODE_9xy0});
-        // table.insert({0xA, &Chip8::OPCODE_ANNN});
-        // table.insert({0xB, &Chip8::OPCODE_BNNN});
-        // table.insert({0xC, &Chip8::OPCODE_CXKK});
-        // table.insert({0xD, &Chip8::OPCODE_Dxyn});
-        // table.insert({0xE, &Chip8::OPCODE_E});
-        // table.insert({0xF, &Chip8::OPCODE_F});
-
-        // table0.insert({0x0, &Chip8::OPCODE_00E0});
-        // table0.insert({0xE, &Chip8::OPCODE_00EE});
-
-        // table8.insert({0x0, &Chip8::OPCODE_8xy0});
-        // table8.insert({0x1, &Chip8::OPCODE_8xy1});
-        // table8.insert({0x2, &Chip8::OPCODE_8xy2});
-        // table8.insert({0x3, &Chip8::OPCODE_8xy3});
-        // table8.insert({0x4, &Chip8::OPCODE_8xy4});
-        // table8.insert({0x5, &Chip8::OPCODE_8xy5});
-        // table8.insert({0x6, &Chip8::OPCODE_8xy6});
-        // table8.insert({0x7, &Chip8::OPCODE_8xy7});
-        // table8.insert({0xE, &Chip8::OPCODE_8xyE});
-
-        // tableE.insert({0x1, &Chip8::OPCODE_ExA1});
-        // tableE.insert({0xE, &Chip8::OPCODE_Ex9E});
-        
-        // tableF.insert({0x07, &Chip8::OPCODE_Fx07});
-        // tableF.insert({0x0A, &Chip8::OPCODE_Fx0A});
-        // tableF.insert({0x15, &Chip8::OPCODE_Fx15});
-        // tableF.insert({0x18, &Chip8::OPCODE_Fx18});
-        // tableF.insert({0x1E, &Chip8::OPCODE_Fx1E});
-        // tableF.insert({0x29, &Chip8::OPCODE_Fx29});
-        // tableF.insert({0x33, &Chip8::OPCODE_Fx33});
-        // tableF.insert({0x55, &Chip8::OPCODE_Fx55});
-        // tableF.insert({0x65, &Chip8::OPCODE_Fx65});
\ No newline at end of file
+// Inline so that Cycle() and the profiler share it without a call per instruction
+inline void Chip8::Fetch(){
+    if((pc & 1u) == 0 && pc < CODE_SIZE){
+        // Fetch the decoded instruction from the cache, decoding it on first use
+        Instruction& cached = icache[pc >> 1];
+        if(cached.handler == nullptr){
+            cached = Decode((memory[pc] << 8u) | memory[pc + 1], quirks);
+        }
+        op = &cached;
+    }
+    else{
+        // Odd pc or code past the first 4K, decode it on the spot
+        scratch = Decode((memory[pc] << 8u) | memory[(pc + 1) & 0xFFFFu], quirks);
+        op = &scratch;
+    }
+
+    opcode = op->opcode; // Current OpCode of Chip 8 (16 bits)
+}
+
+#endif
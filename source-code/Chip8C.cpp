@@ -0,0 +1,280 @@
+#include "Chip8C.h"
+#include "Chip8.hpp"
+#include "Rom.hpp"
+#include "Scheduler.hpp"
+#include "ThreadPool.hpp"
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+using namespace std;
+
+static_assert(CHIP8_MEMORY_SIZE == MEMORY_SIZE && CHIP8_SCREEN_HEIGHT == HIRES_HEIGHT && CHIP8_SCREEN_PLANES == PLANES
+              && CHIP8_FRAME_WIDTH == HIRES_WIDTH && CHIP8_FRAME_HEIGHT == HIRES_HEIGHT, "Chip8C.h is out of date");
+
+struct chip8_machine{
+    Chip8 chip8;
+    Scheduler scheduler;
+    bool memoryShared{}; // chip8_memory() was called, the caller may write memory behind the machine's back
+    uint8_t code[CODE_SIZE]{}; // Memory below CODE_SIZE as the machine last left it, once memoryShared
+};
+
+struct chip8_pool{
+    explicit chip8_pool(unsigned int threads) : pool(threads) {}
+
+    ThreadPool pool;
+    mutex lock; // ParallelFor runs one loop at a time
+};
+
+static thread_local string lastError;
+
+const size_t SCHEDULER_STATE_SIZE = 8 + 8; // Scheduler cycles and timer ticks, after the Chip8 state
+
+static uint8_t* Put64(uint8_t* out, uint64_t value)
+{
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        *out++ = (value >> (8 * i)) & 0xFFu;
+    }
+    return out;
+}
+
+static const uint8_t* Get64(const uint8_t* in, uint64_t& value)
+{
+    value = 0;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        value |= static_cast<uint64_t>(*in++) << (8 * i);
+    }
+    return in;
+}
+
+// Run body, turning the emulator's exceptions into -1 and a message for chip8_last_error()
+template <typename Body>
+static int Guard(Body body)
+{
+    try
+    {
+        body();
+        return 0;
+    }
+    catch (const char* error)
+    {
+        lastError = error;
+    }
+    catch (const bad_alloc&)
+    {
+        lastError = "Out of memory";
+    }
+    return -1;
+}
+
+// Catch up with code the caller overwrote through chip8_memory(): drop what was decoded from it
+static Chip8& Synced(chip8_machine* machine)
+{
+    Chip8& chip8 = machine->chip8;
+    if (machine->memoryShared)
+    {
+        for (unsigned int chunk = 0; chunk < CODE_SIZE; chunk += 64)
+        {
+            if (memcmp(&chip8.memory[chunk], &machine->code[chunk], 64) != 0)
+            {
+                chip8.MemoryWritten(chunk, 64);
+                memcpy(&machine->code[chunk], &chip8.memory[chunk], 64);
+            }
+        }
+    }
+    return chip8;
+}
+
+// Remember the code as the machine itself left it, to tell the caller's next writes apart
+static void Settle(chip8_machine* machine)
+{
+    if (machine->memoryShared)
+    {
+        memcpy(machine->code, machine->chip8.memory, CODE_SIZE);
+    }
+}
+
+// Synced, and memoryTop raised over anything the caller stored higher up, so states and resets cover it
+static Chip8& SyncedWithTop(chip8_machine* machine)
+{
+    Chip8& chip8 = Synced(machine);
+    if (machine->memoryShared)
+    {
+        uint32_t top = MEMORY_SIZE;
+        while (top > chip8.memoryTop && chip8.memory[top - 1] == 0)
+        {
+            top--;
+        }
+        chip8.memoryTop = top;
+    }
+    return chip8;
+}
+
+static Chip8::Engine EngineNamed(const char* name)
+{
+    if (strcmp(name, "interpreter") == 0) return Chip8::Engine::INTERPRETER;
+    if (strcmp(name, "jit") == 0) return Chip8::Engine::JIT;
+    throw "Unknown engine";
+}
+
+extern "C" {
+
+const char* chip8_last_error(void)
+{
+    return lastError.c_str();
+}
+
+chip8_machine* chip8_create(const char* rom, const char* quirks, const char* engine, unsigned int cpu_hz, unsigned int timer_hz, uint32_t seed)
+{
+    chip8_machine* machine = nullptr;
+    Guard([&] {
+        shared_ptr<const Rom> image = RomCache::Get(rom);
+        if (!image)
+        {
+            throw "Could not open the ROM";
+        }
+        QuirkProfile profile = QuirkProfileNamed(quirks);
+        Chip8::Engine selected = EngineNamed(engine);
+
+        machine = new chip8_machine{Chip8(), Scheduler(cpu_hz, timer_hz)};
+        machine->chip8.LoadROM(image);
+        machine->chip8.SetQuirks(profile);
+        machine->chip8.engine = selected;
+        machine->chip8.Seed(seed);
+    });
+    return machine;
+}
+
+chip8_machine* chip8_clone(const chip8_machine* machine)
+{
+    chip8_machine* copy = nullptr;
+    Guard([&] { copy = new chip8_machine(*machine); });
+    return copy;
+}
+
+void chip8_destroy(chip8_machine* machine)
+{
+    delete machine;
+}
+
+int chip8_reset(chip8_machine* machine)
+{
+    return Guard([&] {
+        SyncedWithTop(machine).Reset();
+        Settle(machine);
+    });
+}
+
+int chip8_seed(chip8_machine* machine, uint32_t seed)
+{
+    machine->chip8.Seed(seed);
+    return 0;
+}
+
+int chip8_run(chip8_machine* machine, uint64_t instructions)
+{
+    return Guard([&] {
+        machine->scheduler.Run(Synced(machine), instructions);
+        Settle(machine);
+    });
+}
+
+int chip8_run_frames(chip8_machine* machine, uint32_t frames)
+{
+    return Guard([&] {
+        Synced(machine);
+        for (uint32_t f = 0; f < frames; f++)
+        {
+            machine->scheduler.RunFrame(machine->chip8);
+        }
+        Settle(machine);
+    });
+}
+
+uint8_t* chip8_memory(chip8_machine* machine)
+{
+    if (!machine->memoryShared)
+    {
+        machine->memoryShared = true;
+        Settle(machine);
+    }
+    return machine->chip8.memory;
+}
+
+uint8_t* chip8_registers(chip8_machine* machine) { return machine->chip8.registers; }
+uint8_t* chip8_keypad(chip8_machine* machine) { return machine->chip8.keypad; }
+uint16_t* chip8_stack(chip8_machine* machine) { return machine->chip8.stack; }
+uint64_t* chip8_screen(chip8_machine* machine) { return &machine->chip8.screen[0][0][0]; }
+
+uint16_t chip8_pc(const chip8_machine* machine) { return machine->chip8.pc; }
+uint16_t chip8_index(const chip8_machine* machine) { return machine->chip8.index; }
+uint8_t chip8_sp(const chip8_machine* machine) { return machine->chip8.sp; }
+uint8_t chip8_delay_timer(const chip8_machine* machine) { return machine->chip8.delayTimer; }
+uint8_t chip8_sound_timer(const chip8_machine* machine) { return machine->chip8.soundTimer; }
+int chip8_hires(const chip8_machine* machine) { return machine->chip8.hires ? 1 : 0; }
+uint64_t chip8_cycles(const chip8_machine* machine) { return machine->scheduler.cycles; }
+uint64_t chip8_screen_hash(const chip8_machine* machine) { return machine->chip8.ScreenHash(); }
+
+int chip8_render(const chip8_machine* machine, uint32_t* pixels)
+{
+    machine->chip8.RenderScreen(pixels);
+    return 0;
+}
+
+size_t chip8_state_size(chip8_machine* machine)
+{
+    return SyncedWithTop(machine).StateSize() + SCHEDULER_STATE_SIZE;
+}
+
+int chip8_save_state(chip8_machine* machine, uint8_t* buffer)
+{
+    // The Chip8 state, then where the scheduler is in emulated time so the timers tick on the same instructions again
+    uint8_t* out = buffer + SyncedWithTop(machine).SaveState(buffer);
+    out = Put64(out, machine->scheduler.cycles);
+    Put64(out, machine->scheduler.timerTicks);
+    return 0;
+}
+
+int chip8_load_state(chip8_machine* machine, const uint8_t* buffer, size_t size)
+{
+    return Guard([&] {
+        if (size < SCHEDULER_STATE_SIZE)
+        {
+            throw "Not a saved state of this version";
+        }
+        size_t chip8Size = size - SCHEDULER_STATE_SIZE;
+        SyncedWithTop(machine).LoadState(buffer, chip8Size);
+        Settle(machine);
+        const uint8_t* in = Get64(buffer + chip8Size, machine->scheduler.cycles);
+        Get64(in, machine->scheduler.timerTicks);
+    });
+}
+
+chip8_pool* chip8_pool_create(unsigned int threads)
+{
+    chip8_pool* pool = nullptr;
+    Guard([&] { pool = new chip8_pool(threads); });
+    return pool;
+}
+
+void chip8_pool_destroy(chip8_pool* pool)
+{
+    delete pool;
+}
+
+int chip8_run_batch(chip8_pool* pool, chip8_machine* const* machines, size_t count, uint64_t instructions)
+{
+    return Guard([&] {
+        lock_guard<mutex> guard(pool->lock);
+
+        // One task per machine, like Batch: a machine only ever touches its own state
+        pool->pool.ParallelFor(count, [&](size_t i) {
+            machines[i]->scheduler.Run(Synced(machines[i]), instructions);
+            Settle(machines[i]);
+        });
+    });
+}
+
+}
@@ -0,0 +1,73 @@
+#ifndef CHIP8_C_H
+#define CHIP8_C_H
+
+// C interface to the emulator, built into libchip8.so with `make libchip8.so`, for foreign function interfaces such
+// as Python's ctypes (chip8.py). Functions returning int give 0 on success and -1 on error, functions returning a
+// pointer give NULL on error; chip8_last_error() then says what went wrong.
+// The pointers to memory, registers, keypad, stack and screen point straight into the machine and stay valid until
+// it is destroyed, so callers can read and write them without copies. Code written through chip8_memory() is noticed
+// by the next call that runs, saves, loads or resets the machine, which drops whatever was decoded from the old bytes. Different machines may be used from different
+// threads at the same time; one machine must not.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIP8_MEMORY_SIZE 0x10000
+#define CHIP8_SCREEN_HEIGHT 64 // Rows of chip8_screen(), 32 of them used in low resolution
+#define CHIP8_SCREEN_PLANES 2
+#define CHIP8_SCREEN_WORDS 2 // 64-bit words per row and plane, bit 63 of word 0 is the leftmost pixel
+#define CHIP8_FRAME_WIDTH 128 // Pixels written by chip8_render(), low resolution doubled
+#define CHIP8_FRAME_HEIGHT 64
+
+typedef struct chip8_machine chip8_machine;
+typedef struct chip8_pool chip8_pool;
+
+const char* chip8_last_error(void); // Message of the last error on the calling thread
+
+// A machine running rom with the quirks (modern, vip, schip, xochip) and engine (interpreter, jit) named,
+// cpu_hz instructions per second, timers at timer_hz, random numbers from seed
+chip8_machine* chip8_create(const char* rom, const char* quirks, const char* engine, unsigned int cpu_hz, unsigned int timer_hz, uint32_t seed);
+chip8_machine* chip8_clone(const chip8_machine* machine); // Independent copy, in the same state
+void chip8_destroy(chip8_machine* machine);
+
+int chip8_reset(chip8_machine* machine); // Start the ROM over, see Chip8::Reset
+int chip8_seed(chip8_machine* machine, uint32_t seed);
+int chip8_run(chip8_machine* machine, uint64_t instructions); // Execute instructions, ticking the timers where they fall
+int chip8_run_frames(chip8_machine* machine, uint32_t frames); // Execute frames timer periods
+
+uint8_t* chip8_memory(chip8_machine* machine); // CHIP8_MEMORY_SIZE bytes
+uint8_t* chip8_registers(chip8_machine* machine); // V0 to VF
+uint8_t* chip8_keypad(chip8_machine* machine); // 16 keys, nonzero while held
+uint16_t* chip8_stack(chip8_machine* machine); // 16 return addresses
+uint64_t* chip8_screen(chip8_machine* machine); // [CHIP8_SCREEN_HEIGHT][CHIP8_SCREEN_PLANES][CHIP8_SCREEN_WORDS]
+
+uint16_t chip8_pc(const chip8_machine* machine);
+uint16_t chip8_index(const chip8_machine* machine);
+uint8_t chip8_sp(const chip8_machine* machine);
+uint8_t chip8_delay_timer(const chip8_machine* machine);
+uint8_t chip8_sound_timer(const chip8_machine* machine);
+int chip8_hires(const chip8_machine* machine); // 1 in the 128 x 64 mode
+uint64_t chip8_cycles(const chip8_machine* machine); // Instructions executed since creation
+uint64_t chip8_screen_hash(const chip8_machine* machine);
+int chip8_render(const chip8_machine* machine, uint32_t* pixels); // CHIP8_FRAME_WIDTH * CHIP8_FRAME_HEIGHT RGBA pixels
+
+// States hold the machine and its place in emulated time (chip8_cycles() and the timer ticks delivered), so a restored
+// machine runs on exactly as the saved one would have
+size_t chip8_state_size(chip8_machine* machine); // Bytes of a state of the machine as it is now, which grow with the memory in use
+int chip8_save_state(chip8_machine* machine, uint8_t* buffer); // Writes chip8_state_size(machine) bytes
+int chip8_load_state(chip8_machine* machine, const uint8_t* buffer, size_t size);
+
+chip8_pool* chip8_pool_create(unsigned int threads); // 0 uses every hardware thread
+void chip8_pool_destroy(chip8_pool* pool);
+// Run instructions on every machine in parallel; the machines must be distinct. Concurrent calls on one pool take turns
+int chip8_run_batch(chip8_pool* pool, chip8_machine* const* machines, size_t count, uint64_t instructions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
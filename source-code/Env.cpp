@@ -0,0 +1,206 @@
+#include "Env.hpp"
+#include "Rom.hpp"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+// Keep the even bits of x, packed into its low 32 bits in order
+static uint64_t CompressEvenBits(uint64_t x)
+{
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return x;
+}
+
+// 64 pixels (bit 63 leftmost) halved to 32, each set when either of its pair is
+static uint64_t HalveRow(uint64_t row)
+{
+    return CompressEvenBits(row | (row >> 1));
+}
+
+Env::Env(const char* rom, const Config& config, uint64_t* observation)
+: config(config), scheduler(config.cpuHz, config.timerHz), random(config.seed),
+  observation(observation ? observation : ownObservation)
+{
+    if (this->config.actions.empty())
+    {
+        this->config.actions.push_back(0);
+        for (unsigned int k = 0; k < 16; k++)
+        {
+            this->config.actions.push_back(1u << k);
+        }
+    }
+    this->config.frameSkip = max(this->config.frameSkip, 1u);
+
+    shared_ptr<const Rom> image = RomCache::Get(rom);
+    if (!image)
+    {
+        throw "Could not open the ROM";
+    }
+    chip8.LoadROM(image);
+    chip8.SetQuirks(config.quirks);
+    chip8.engine = config.engine;
+
+    Reset();
+}
+
+void Env::Reset()
+{
+    chip8.Reset();
+    chip8.Seed(random());
+    scheduler = Scheduler(config.cpuHz, config.timerHz);
+
+    held = 0;
+    frames = 0;
+    score = Score();
+    Observe();
+}
+
+Env::StepResult Env::Step(unsigned int action)
+{
+    if (action >= config.actions.size())
+    {
+        throw "Action out of range";
+    }
+
+    StepResult result;
+    for (unsigned int f = 0; f < config.frameSkip; f++)
+    {
+        // Sticky actions: the game sometimes misses a change of keys for a frame, so agents cannot rely on exact timing
+        if (config.stickyActions <= 0 || chance(random) >= config.stickyActions)
+        {
+            held = config.actions[action];
+        }
+        for (unsigned int k = 0; k < 16; k++)
+        {
+            chip8.keypad[k] = (held >> k) & 1u;
+        }
+
+        scheduler.RunFrame(chip8);
+        frames++;
+
+        for (const RamCondition& condition : config.done)
+        {
+            result.done = result.done || Read(condition.value) == condition.equals;
+        }
+        result.done = result.done || Halted();
+        if (result.done)
+        {
+            break;
+        }
+        if (config.maxFrames != 0 && frames >= config.maxFrames)
+        {
+            result.truncated = true;
+            break;
+        }
+    }
+
+    double now = Score();
+    result.reward = static_cast<float>(now - score);
+    score = now;
+
+    Observe();
+    return result;
+}
+
+double Env::Read(const RamValue& value) const
+{
+    uint32_t number = 0;
+    for (unsigned int i = 0; i < min<unsigned int>(value.length, 4); i++)
+    {
+        uint8_t byte = chip8.memory[(value.address + i) & 0xFFFFu];
+        number = value.bcd ? number * 10 + byte : (number << 8) | byte;
+    }
+    return number;
+}
+
+double Env::Score() const
+{
+    double sum = 0;
+    for (const RamValue& value : config.reward)
+    {
+        sum += value.scale * Read(value);
+    }
+    return sum;
+}
+
+bool Env::Halted() const
+{
+    uint16_t opcode = (chip8.memory[chip8.pc] << 8u) | chip8.memory[(chip8.pc + 1) & 0xFFFFu];
+    return opcode == 0x00FD || opcode == (0x1000u | chip8.pc);
+}
+
+void Env::Observe()
+{
+    for (unsigned int y = 0; y < OBSERVATION_WORDS; y++)
+    {
+        if (!chip8.hires)
+        {
+            uint64_t row = 0;
+            for (unsigned int p = 0; p < PLANES; p++)
+            {
+                row |= chip8.screen[y][p][0];
+            }
+            observation[y] = row;
+            continue;
+        }
+
+        // Two rows of 128 pixels into one of 64
+        uint64_t left = 0;
+        uint64_t right = 0;
+        for (unsigned int p = 0; p < PLANES; p++)
+        {
+            left |= chip8.screen[2 * y][p][0] | chip8.screen[2 * y + 1][p][0];
+            right |= chip8.screen[2 * y][p][1] | chip8.screen[2 * y + 1][p][1];
+        }
+        observation[y] = (HalveRow(left) << 32) | HalveRow(right);
+    }
+}
+
+VecEnv::VecEnv(ThreadPool& pool, size_t count, const char* rom, const Env::Config& config)
+: pool(pool), observations(count * Env::OBSERVATION_WORDS), rewards(count), dones(count), truncations(count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        Env::Config own = config;
+        own.seed = config.seed + static_cast<uint32_t>(i);
+        envs.push_back(make_unique<Env>(rom, own, &observations[i * Env::OBSERVATION_WORDS]));
+    }
+}
+
+void VecEnv::Reset()
+{
+    pool.ParallelFor(envs.size(), [&](size_t i) {
+        envs[i]->Reset();
+        rewards[i] = 0;
+        dones[i] = 0;
+        truncations[i] = 0;
+    });
+}
+
+void VecEnv::Step(const unsigned int* actions)
+{
+    // Check first, an exception must not escape a worker thread
+    for (size_t i = 0; i < envs.size(); i++)
+    {
+        if (actions[i] >= envs[i]->ActionCount())
+        {
+            throw "Action out of range";
+        }
+    }
+
+    pool.ParallelFor(envs.size(), [&](size_t i) {
+        Env::StepResult result = envs[i]->Step(actions[i]);
+        rewards[i] = result.reward;
+        dones[i] = result.done;
+        truncations[i] = result.truncated;
+        if (result.done || result.truncated)
+        {
+            envs[i]->Reset();
+        }
+    });
+}
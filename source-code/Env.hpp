@@ -0,0 +1,128 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+#include "Chip8.hpp"
+#include "Scheduler.hpp"
+#include "ThreadPool.hpp"
+using namespace std;
+
+// A Chip8 game as a reinforcement learning environment, in the style of Gym and the Arcade Learning Environment.
+// Step(action) holds the keys of one entry of the action set for frameSkip frames and returns the reward earned and
+// whether the episode ended; the observation is the screen at 64 x 32, one bit per pixel, packed like Chip8::screen
+// (row y is one word, bit 63 leftmost). High resolution screens are downsampled, a pixel set when any of its 2 x 2
+// pixels is, and bitplanes are merged.
+// Rewards and the end of an episode are read from memory, where games keep their score (often as the BCD digits
+// Fx33 writes) and lives. An episode also ends when the program halts (00FD, or a jump to itself) and is
+// truncated after maxFrames frames.
+class Env
+{
+public:
+    static const size_t OBSERVATION_WORDS = VIDEO_HEIGHT; // uint64_t words of one observation
+
+    // A number kept in memory
+    struct RamValue{
+        uint16_t address{};
+        uint8_t length{1}; // Bytes, at most 4
+        bool bcd{}; // One decimal digit per byte, most significant first, as Fx33 stores them; otherwise big-endian binary
+        float scale{1}; // Weight of the value in the reward, negative for penalties such as lives lost
+    };
+
+    // Ends the episode once value reads equals
+    struct RamCondition{
+        RamValue value;
+        uint32_t equals{};
+    };
+
+    struct Config{
+        unsigned int cpuHz{700}; // Scheduler speeds, each frame is one timer period
+        unsigned int timerHz{60};
+        QuirkProfile quirks{QuirkProfile::MODERN};
+        Chip8::Engine engine{Chip8::Engine::INTERPRETER}; // The fastest engine on most ROMs, JIT is opt-in
+
+        unsigned int frameSkip{4}; // Frames per step, the action held through all of them
+        float stickyActions{0.25f}; // Chance in every frame that the previous frame's keys stay held instead of the action's
+        uint64_t maxFrames{}; // Frames before an episode is truncated, 0 for no limit
+        uint32_t seed{}; // Seeds sticky actions and the machine's random numbers of every episode
+
+        vector<uint16_t> actions; // Key mask of every action, empty for no keys plus each of the 16 keys alone
+        vector<RamValue> reward; // The reward of a step is how much the weighted sum of these changed over it
+        vector<RamCondition> done; // Any of them being met ends the episode
+    };
+
+    struct StepResult{
+        float reward{};
+        bool done{}; // The game ended: a condition was met or the program halted
+        bool truncated{}; // maxFrames ran out first
+    };
+
+    // Load rom through RomCache, throws if it cannot be read. The observation is written to observation[OBSERVATION_WORDS],
+    // or to a buffer of the environment's own when it is nullptr
+    Env(const char* rom, const Config& config, uint64_t* observation = nullptr);
+
+    Env(const Env&) = delete;
+    Env& operator=(const Env&) = delete;
+
+    void Reset(); // Start a new episode and observe its first frame
+    StepResult Step(unsigned int action); // Throws if action is not in the action set
+
+    const uint64_t* Observation() const { return observation; }
+    size_t ActionCount() const { return config.actions.size(); }
+    uint64_t Frames() const { return frames; } // Frames of the current episode so far
+
+    Chip8 chip8; // The machine, free to inspect between steps
+
+private:
+    double Read(const RamValue& value) const;
+    double Score() const; // Weighted sum of the reward values
+    bool Halted() const; // The program stopped making progress on its own
+    void Observe(); // Write the current screen into observation
+
+    Config config;
+    Scheduler scheduler;
+    minstd_rand random; // Sticky actions and episode seeds
+    uniform_real_distribution<float> chance{0.0f, 1.0f};
+
+    uint16_t held{}; // Keys held during the last frame
+    uint64_t frames{};
+    double score{}; // Score() after the last step
+
+    uint64_t ownObservation[OBSERVATION_WORDS]{};
+    uint64_t* observation;
+};
+
+// Many environments stepped together on a ThreadPool, like Batch. Observations, rewards and flags live in contiguous
+// arrays that the environments write in place, so a training loop reads them without copies.
+// An environment whose episode ended starts a new one within the same Step(): its reward and flags describe the
+// step that ended, its observation is the first of the new episode.
+class VecEnv
+{
+public:
+    // count environments on rom, environment i seeded with config.seed + i
+    VecEnv(ThreadPool& pool, size_t count, const char* rom, const Env::Config& config);
+
+    void Reset(); // Start a new episode in every environment
+    void Step(const unsigned int* actions); // actions[i] for environment i, in parallel
+
+    const uint64_t* Observations() const { return observations.data(); } // Env::OBSERVATION_WORDS words per environment
+    const float* Rewards() const { return rewards.data(); }
+    const uint8_t* Dones() const { return dones.data(); }
+    const uint8_t* Truncations() const { return truncations.data(); }
+
+    size_t Size() const { return envs.size(); }
+    Env& operator[](size_t i) { return *envs[i]; }
+
+private:
+    ThreadPool& pool;
+    vector<uint64_t> observations;
+    vector<float> rewards;
+    vector<uint8_t> dones;
+    vector<uint8_t> truncations;
+    vector<unique_ptr<Env>> envs;
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include "Chip8.hpp"
+#include "Scheduler.hpp"
+#include "Movie.hpp"
+#include "Profiler.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstring>
+using namespace std;
+
+const unsigned int FRAME_RATE = 60; // Emulated frames per second, also the timer rate
+
+// Keys held from a given frame on, one line "<Frame> <HexKeyMask>" of the key script
+struct KeyEvent{
+    uint64_t frame;
+    uint16_t keys; // Bit k set while key k is held
+};
+
+// Read a key script: one "<Frame> <HexKeyMask>" per line in increasing frame order, '#' starts a comment
+static vector<KeyEvent> LoadKeyScript(const char* filename)
+{
+    ifstream file(filename);
+    if (!file.is_open())
+    {
+        throw "Could not open the key script";
+    }
+
+    vector<KeyEvent> events;
+    string line;
+    while (getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+
+        istringstream fields(line);
+        KeyEvent event;
+        unsigned int keys;
+        if (!(fields >> event.frame))
+        {
+            continue; // Blank or comment line
+        }
+        if (!(fields >> hex >> keys) || keys > 0xFFFF)
+        {
+            throw "Malformed line in the key script";
+        }
+        if (!events.empty() && event.frame < events.back().frame)
+        {
+            throw "Key script frames must not decrease";
+        }
+
+        event.keys = keys;
+        events.push_back(event);
+    }
+
+    return events;
+}
+
+// Write the screen as a binary PBM (P4), whose rows are packed leftmost pixel first just like Chip8::screen
+static void WritePBM(const Chip8& chip8, const string& filename)
+{
+    ofstream file(filename, ios::binary);
+    if (!file.is_open())
+    {
+        throw "Could not write a PBM frame";
+    }
+
+    // At the current resolution, so low resolution frames stay 64 x 32
+    file << "P4\n" << chip8.ScreenWidth() << " " << chip8.ScreenHeight() << "\n";
+    for (unsigned int y = 0; y < chip8.ScreenHeight(); y++)
+    {
+        for (unsigned int word = 0; word < chip8.ScreenWidth() / 64; word++)
+        {
+            for (int shift = 56; shift >= 0; shift -= 8)
+            {
+                // A pixel on in any plane is black
+                file.put(static_cast<char>(((chip8.screen[y][0][word] | chip8.screen[y][1][word]) >> shift) & 0xFFu));
+            }
+        }
+    }
+}
+
+static void PrintRegisters(const Chip8& chip8)
+{
+    cout << hex << uppercase << setfill('0');
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        cout << "V" << i << ": " << setw(2) << +chip8.registers[i] << ((i % 8 == 7) ? "\n" : "  ");
+    }
+    cout << "I: " << setw(3) << chip8.index << "  PC: " << setw(3) << chip8.pc << "  SP: " << +chip8.sp
+         << "  DT: " << setw(2) << +chip8.delayTimer << "  ST: " << setw(2) << +chip8.soundTimer << "\n";
+    cout << dec << nouppercase << setfill(' ');
+}
+
+int main(int inputSize, char** input)
+{
+    if (inputSize < 3)
+    {
+        cout << "FORMAT OF USE: " << input[0] << " <ROM> <Frames> [--ipf <InstructionsPerFrame>] [--engine interpreter|jit]"
+             << " [--keys <KeyScript>] [--quirks modern|vip|schip|xochip] [--seed <Seed>] [--record <Movie>] [--replay <Movie>] [--hash] [--registers] [--pbm <Prefix>]"
+             << " [--profile] [--folded <File>]\n";
+        cout << "With --replay, <Frames> of 0 runs to the end of the movie\n";
+        exit(EXIT_FAILURE);
+    }
+
+    try{
+        char const* ROM = input[1];
+        uint64_t frames = stoull(input[2]);
+
+        unsigned int instructionsPerFrame = 11; // About 660 instructions per second
+        Chip8::Engine engine = Chip8::Engine::INTERPRETER;
+        const char* keyScript = nullptr;
+        bool printHash = false;
+        bool printRegisters = false;
+        const char* pbmPrefix = nullptr;
+        uint32_t seed = 0; // Fixed by default so that runs repeat
+        QuirkProfile quirks = QuirkProfile::MODERN;
+        const char* recordFile = nullptr;
+        const char* replayFile = nullptr;
+        bool profile = false;
+        const char* foldedFile = nullptr;
+
+        for (int i = 3; i < inputSize; i++)
+        {
+            bool hasValue = (i + 1 < inputSize);
+
+            if (strcmp(input[i], "--ipf") == 0 && hasValue)
+            {
+                instructionsPerFrame = stoi(input[++i]);
+            }
+            else if (strcmp(input[i], "--engine") == 0 && hasValue)
+            {
+                string name = input[++i];
+                if (name == "interpreter") engine = Chip8::Engine::INTERPRETER;
+                else if (name == "jit") engine = Chip8::Engine::JIT;
+                else throw "Unknown engine";
+            }
+            else if (strcmp(input[i], "--keys") == 0 && hasValue)
+            {
+                keyScript = input[++i];
+            }
+            else if (strcmp(input[i], "--quirks") == 0 && hasValue)
+            {
+                quirks = QuirkProfileNamed(input[++i]);
+            }
+            else if (strcmp(input[i], "--seed") == 0 && hasValue)
+            {
+                seed = stoul(input[++i]);
+            }
+            else if (strcmp(input[i], "--record") == 0 && hasValue)
+            {
+                recordFile = input[++i];
+            }
+            else if (strcmp(input[i], "--replay") == 0 && hasValue)
+            {
+                replayFile = input[++i];
+            }
+            else if (strcmp(input[i], "--pbm") == 0 && hasValue)
+            {
+                pbmPrefix = input[++i];
+            }
+            else if (strcmp(input[i], "--profile") == 0)
+            {
+                profile = true;
+            }
+            else if (strcmp(input[i], "--folded") == 0 && hasValue)
+            {
+                foldedFile = input[++i];
+            }
+            else if (strcmp(input[i], "--hash") == 0)
+            {
+                printHash = true;
+            }
+            else if (strcmp(input[i], "--registers") == 0)
+            {
+                printRegisters = true;
+            }
+            else
+            {
+                throw "Unknown or incomplete option";
+            }
+        }
+
+        // Without an output spec, the screen hash is the result
+        if (!printRegisters && !pbmPrefix)
+        {
+            printHash = true;
+        }
+
+        if (instructionsPerFrame == 0)
+        {
+            throw "Instructions per frame must be positive";
+        }
+
+        if (keyScript && replayFile)
+        {
+            throw "A key script and a replayed movie cannot be combined";
+        }
+
+        // LoadROM ignores missing files, a batch run should not; the hash doubles as that check
+        uint64_t romHash = Movie::HashROM(ROM);
+
+        vector<KeyEvent> events;
+        if (keyScript)
+        {
+            events = LoadKeyScript(keyScript);
+        }
+
+        // A replay takes seed and speed from the movie, so the run repeats bit for bit
+        Movie replay;
+        unsigned int cpuHz = instructionsPerFrame * FRAME_RATE;
+        unsigned int timerHz = FRAME_RATE;
+        if (replayFile)
+        {
+            replay.Load(replayFile);
+            if (replay.romHash != romHash)
+            {
+                throw "The movie was recorded with a different ROM";
+            }
+
+            seed = replay.seed;
+            quirks = replay.quirks;
+            cpuHz = replay.cpuHz;
+            timerHz = replay.timerHz;
+            if (frames == 0)
+            {
+                frames = replay.frames.size();
+            }
+        }
+
+        Movie record;
+        record.seed = seed;
+        record.cpuHz = cpuHz;
+        record.timerHz = timerHz;
+        record.romHash = romHash;
+        record.quirks = quirks;
+
+        Chip8 chip8;
+        chip8.LoadROM(ROM);
+        chip8.Seed(seed);
+        chip8.SetQuirks(quirks);
+        chip8.engine = engine;
+
+        // Profiling interprets every instruction, whatever engine was asked for
+        Profiler profiler;
+        if (profile || foldedFile)
+        {
+            chip8.engine = Chip8::Engine::PROFILE;
+            chip8.profiler = &profiler;
+        }
+
+        // Emulated time only, the loop never waits for the wall clock
+        Scheduler scheduler(cpuHz, timerHz);
+        size_t nextEvent = 0;
+
+        for (uint64_t frame = 0; frame < frames; frame++)
+        {
+            // Apply the key changes scheduled for this frame
+            while (nextEvent < events.size() && events[nextEvent].frame <= frame)
+            {
+                Movie::ApplyKeys(events[nextEvent].keys, chip8.keypad);
+                nextEvent++;
+            }
+
+            // Past the end of a replayed movie every key is released
+            if (replayFile)
+            {
+                Movie::ApplyKeys(frame < replay.frames.size() ? replay.frames[frame] : 0, chip8.keypad);
+            }
+            if (recordFile)
+            {
+                record.frames.push_back(Movie::KeyMask(chip8.keypad));
+            }
+
+            scheduler.RunFrame(chip8);
+
+            // One image per frame that changed the screen
+            if (pbmPrefix && chip8.screenDirty)
+            {
+                ostringstream name;
+                name << pbmPrefix << setfill('0') << setw(6) << frame << ".pbm";
+                WritePBM(chip8, name.str());
+            }
+            chip8.screenDirty = false;
+            chip8.dirtyRows = 0;
+        }
+
+        if (recordFile)
+        {
+            record.Save(recordFile);
+        }
+
+        if (printHash)
+        {
+            cout << "hash: " << hex << setfill('0') << setw(16) << chip8.ScreenHash() << dec << setfill(' ') << "\n";
+        }
+        if (printRegisters)
+        {
+            PrintRegisters(chip8);
+        }
+        cout << "cycles: " << scheduler.cycles << "\n";
+
+        if (profile)
+        {
+            cout << "\n";
+            profiler.Report(cout);
+        }
+        if (foldedFile)
+        {
+            ofstream folded(foldedFile);
+            if (!folded.is_open())
+            {
+                throw "Could not write the folded stacks";
+            }
+            profiler.WriteFolded(folded);
+        }
+    }
+    catch (const char* e)
+    {
+        cout << "AN ERROR OCCURRED !!!!!!!!!!!!" << endl;
+        cout << e << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
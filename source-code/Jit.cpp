@@ -0,0 +1,771 @@
+#include "Jit.hpp"
+#include <atomic>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define JIT_X64 1
+    #ifdef _WIN32
+        #include <windows.h>
+    #else
+        #include <sys/mman.h>
+    #endif
+#endif
+
+using namespace std;
+
+const unsigned int JIT_CODE_SIZE = 0x1000; // Memory jumps reach, blocks only start at even addresses below it (CODE_SIZE)
+const size_t JIT_TABLE_BYTES = JIT_CODE_SIZE / 2 * sizeof(void*); // Entry point for every even address, never executable
+const size_t JIT_BUFFER_SIZE = 1024 * 1024; // Table and code per cache
+const size_t JIT_PAGE_SIZE = 4096; // Granularity of the protection changes
+const unsigned int JIT_MAX_INSTRUCTIONS = 64; // Longer blocks stay with the interpreter
+const size_t JIT_MAX_BLOCK_SIZE = JIT_MAX_INSTRUCTIONS * 256 + 512; // Upper bound on the code emitted for one block
+
+static atomic<uint32_t> nextGeneration{1}; // Generations are unique across all caches
+
+#ifdef JIT_X64
+
+// rbx holds the machine pointer and r15 the remaining budget for as long as generated code runs; al and dl are scratch
+const uint8_t BASE = 3; // rbx
+const uint8_t AL = 0;
+const uint8_t DL = 2;
+
+// Host registers V0-VF and I live in, most used first: everything but the scratch, base, budget and stack registers
+const uint8_t HOST_REGISTERS[] = {1, 6, 7, 8, 9, 10, 11, 5, 12, 13, 14}; // rcx, rsi, rdi, r8-r11, rbp, r12-r14
+const unsigned int GUESTS = 17; // V0-VF, then I
+const unsigned int INDEX = 16;
+
+// Condition codes for JumpIf
+const uint8_t BELOW = 0x2;
+const uint8_t ABOVE_OR_EQUAL = 0x3;
+const uint8_t EQUAL = 0x4;
+const uint8_t NOT_EQUAL = 0x5;
+
+// A register, or [BASE + disp32]
+struct Operand
+{
+    bool memory;
+    uint8_t reg;
+    int32_t disp;
+};
+
+static Operand Register(uint8_t reg) { return {false, reg, 0}; }
+static Operand Memory(ptrdiff_t disp) { return {true, 0, static_cast<int32_t>(disp)}; }
+
+// Small x86-64 assembler writing into a fixed buffer
+class Emitter
+{
+public:
+    explicit Emitter(uint8_t* out) : code(out) {}
+
+    void Byte(uint8_t b) { code[size++] = b; }
+
+    void Bytes(initializer_list<uint8_t> bytes)
+    {
+        for (uint8_t b : bytes)
+        {
+            Byte(b);
+        }
+    }
+
+    void Imm16(uint16_t imm) { memcpy(&code[size], &imm, sizeof(imm)); size += sizeof(imm); }
+    void Imm32(int32_t imm) { memcpy(&code[size], &imm, sizeof(imm)); size += sizeof(imm); }
+    void Imm64(uint64_t imm) { memcpy(&code[size], &imm, sizeof(imm)); size += sizeof(imm); }
+
+    // <opcode> reg, rm with a ModRM byte, reg being a register or an opcode extension. Always carries a REX prefix,
+    // so byte registers 4-7 are spl, bpl, sil and dil rather than ah-bh; word adds the operand size prefix
+    void Op(initializer_list<uint8_t> opcode, uint8_t reg, Operand rm, bool word = false)
+    {
+        if (word)
+        {
+            Byte(0x66);
+        }
+        Byte(0x40 | ((reg & 8) ? 0x4 : 0) | ((!rm.memory && (rm.reg & 8)) ? 0x1 : 0));
+        Bytes(opcode);
+        if (rm.memory)
+        {
+            Byte(0x80 | ((reg & 7) << 3) | BASE);
+            Imm32(rm.disp);
+        }
+        else
+        {
+            Byte(0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+        }
+    }
+
+    uint8_t* Here() const { return code + size; }
+    void Rel32(const uint8_t* target) { Imm32(static_cast<int32_t>(target - (Here() + 4))); } // Ends the instruction
+    void Jump(const uint8_t* target) { Byte(0xE9); Rel32(target); } // jmp target
+    void JumpIf(uint8_t condition, const uint8_t* target) { Byte(0x0F); Byte(0x80 | condition); Rel32(target); } // j<cc> target
+
+    // j<cc> to a label emitted later, returns where to Land() it
+    size_t JumpForward(uint8_t condition)
+    {
+        Byte(0x0F); Byte(0x80 | condition);
+        size_t at = size;
+        Imm32(0);
+        return at;
+    }
+
+    void Land(size_t at) { int32_t rel = static_cast<int32_t>(size - (at + 4)); memcpy(&code[at], &rel, sizeof(rel)); }
+
+    uint8_t* code;
+    size_t size{};
+};
+
+// Whether an opcode ending a block is translated into a native jump, rather than a fallback call and a dispatch
+static bool Branches(uint16_t opcode, const Quirks& quirks)
+{
+    switch (opcode >> 12)
+    {
+        case 0x1:
+            return true;
+        case 0x3:
+        case 0x4:
+        case 0x9:
+            return !quirks.skipsLongLoad; // Those skips read the next instruction
+        case 0x5:
+            return !quirks.skipsLongLoad && (opcode & 0x000Fu) != 0x2 && (opcode & 0x000Fu) != 0x3;
+        default:
+            return false;
+    }
+}
+
+// Count the guest registers a natively translated opcode reads or writes
+static void CountUses(uint16_t opcode, const Quirks& quirks, unsigned int uses[GUESTS])
+{
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t n = opcode & 0x000Fu;
+
+    switch (opcode >> 12)
+    {
+        case 0x3:
+        case 0x4:
+        case 0x6:
+        case 0x7:
+            uses[x]++;
+            break;
+        case 0x5:
+        case 0x9:
+            uses[x]++;
+            uses[y]++;
+            break;
+        case 0x8:
+            uses[x]++;
+            uses[y]++;
+            if (n >= 0x4 || quirks.logicResetsVf)
+            {
+                uses[0xF]++;
+            }
+            break;
+        case 0xA:
+            uses[INDEX]++;
+            break;
+        case 0xF:
+            uses[x]++;
+            if ((opcode & 0x00FFu) == 0x1E)
+            {
+                uses[INDEX]++;
+            }
+            break;
+    }
+}
+
+// Emits one block, keeping the guest registers it uses most in host registers: loaded on first use, written back
+// before anything outside the block can see them
+class Translator
+{
+public:
+    Translator(Emitter& emitter, const JitCache::Layout& layout, const Quirks& quirks, const uint8_t* const* table,
+               const uint8_t* exit, const uint8_t* dispatch)
+    : e(emitter), layout(layout), quirks(quirks), table(table), exit(exit), dispatch(dispatch)
+    {
+        memset(host, -1, sizeof(host));
+    }
+
+    // Give host registers to the guests used at least twice, a single use is cheaper straight on memory
+    void Allocate(const unsigned int uses[GUESTS])
+    {
+        bool taken[GUESTS]{};
+        for (uint8_t reg : HOST_REGISTERS)
+        {
+            unsigned int best = GUESTS;
+            for (unsigned int g = 0; g < GUESTS; g++)
+            {
+                if (!taken[g] && uses[g] >= 2 && (best == GUESTS || uses[g] > uses[best]))
+                {
+                    best = g;
+                }
+            }
+            if (best == GUESTS)
+            {
+                break;
+            }
+            taken[best] = true;
+            host[best] = static_cast<int8_t>(reg);
+        }
+    }
+
+    Operand Home(unsigned int g) const { return Memory(g == INDEX ? layout.index : layout.registers + g); }
+
+    Operand Read(unsigned int g)
+    {
+        if (host[g] < 0)
+        {
+            return Home(g);
+        }
+        if (!loaded[g])
+        {
+            e.Op({0x0F, static_cast<uint8_t>(g == INDEX ? 0xB7 : 0xB6)}, host[g], Home(g)); // movzx host, [home]
+            loaded[g] = true;
+        }
+        return Register(host[g]);
+    }
+
+    // Operand for a guest about to be overwritten, without loading it
+    Operand Write(unsigned int g)
+    {
+        if (host[g] < 0)
+        {
+            return Home(g);
+        }
+        loaded[g] = true;
+        dirty[g] = true;
+        return Register(host[g]);
+    }
+
+    Operand Modify(unsigned int g)
+    {
+        Operand operand = Read(g);
+        dirty[g] = host[g] >= 0;
+        return operand;
+    }
+
+    // Write the changed host registers back
+    void Spill()
+    {
+        for (unsigned int g = 0; g < GUESTS; g++)
+        {
+            if (host[g] >= 0 && dirty[g])
+            {
+                e.Op({static_cast<uint8_t>(g == INDEX ? 0x89 : 0x88)}, host[g], Home(g), g == INDEX); // mov [home], host
+                dirty[g] = false;
+            }
+        }
+    }
+
+    // Vx = source
+    void Move(unsigned int x, Operand source)
+    {
+        Operand target = Write(x);
+        if (!target.memory)
+        {
+            e.Op({0x8A}, target.reg, source);
+        }
+        else if (!source.memory)
+        {
+            e.Op({0x88}, source.reg, target);
+        }
+        else
+        {
+            e.Op({0x8A}, AL, source);
+            e.Op({0x88}, AL, target);
+        }
+    }
+
+    // Vx = Vx <op> source, opcode being the reg, r/m form; source must not be al
+    void Apply(uint8_t opcode, unsigned int x, Operand source)
+    {
+        Operand target = Modify(x);
+        if (!target.memory)
+        {
+            e.Op({opcode}, target.reg, source);
+            return;
+        }
+        e.Op({0x8A}, AL, target);
+        e.Op({opcode}, AL, source);
+        e.Op({0x88}, AL, target);
+    }
+
+    void StoreWord(ptrdiff_t disp, uint16_t value) { e.Op({0xC7}, 0, Memory(disp), true); e.Imm16(value); } // mov word [base+disp], imm16
+
+    // Mirrors the interpreter's order of register reads and writes, so aliased registers end up the same
+    void Instruction(uint16_t opcode)
+    {
+        uint8_t x = (opcode & 0x0F00u) >> 8u;
+        uint8_t y = (opcode & 0x00F0u) >> 4u;
+        uint8_t kk = opcode & 0x00FFu;
+        const uint8_t VF = 0xF;
+
+        switch (opcode >> 12)
+        {
+            case 0x6: // Vx = kk
+                e.Op({0xC6}, 0, Write(x));
+                e.Byte(kk);
+                break;
+
+            case 0x7: // Vx += kk
+                e.Op({0x80}, 0, Modify(x));
+                e.Byte(kk);
+                break;
+
+            case 0x8:
+                switch (opcode & 0x000Fu)
+                {
+                    case 0x0: // Vx = Vy
+                        Move(x, Read(y));
+                        break;
+
+                    case 0x1: // Vx |= Vy
+                    case 0x2: // Vx &= Vy
+                    case 0x3: // Vx ^= Vy
+                    {
+                        const uint8_t LOGIC[] = {0, 0x0A, 0x22, 0x32};
+                        Apply(LOGIC[opcode & 0x000Fu], x, Read(y));
+                        if (quirks.logicResetsVf)
+                        {
+                            e.Op({0xC6}, 0, Write(VF));
+                            e.Byte(0);
+                        }
+                        break;
+                    }
+
+                    case 0x4: // Vx += Vy, VF = carry (VF written first)
+                    {
+                        e.Op({0x8A}, AL, Read(x));
+                        Operand source = Read(y); // Loads leave the flags alone
+                        e.Op({0x02}, AL, source);
+                        e.Bytes({0x0F, 0x92, 0xC2}); // setc dl
+                        Move(VF, Register(DL));
+                        Move(x, Register(AL));
+                        break;
+                    }
+
+                    case 0x5: // VF = Vx > Vy, then Vx -= Vy
+                    case 0x7: // VF = Vy > Vx, then Vx = Vy - Vx
+                    {
+                        uint8_t left = ((opcode & 0x000Fu) == 0x5) ? x : y;
+                        uint8_t right = ((opcode & 0x000Fu) == 0x5) ? y : x;
+                        e.Op({0x8A}, AL, Read(left));
+                        Operand source = Read(right);
+                        e.Op({0x3A}, AL, source);
+                        e.Bytes({0x0F, 0x97, 0xC2}); // seta dl
+                        Move(VF, Register(DL));
+                        e.Op({0x8A}, AL, Read(left));
+                        source = Read(right);
+                        e.Op({0x2A}, AL, source);
+                        Move(x, Register(AL));
+                        break;
+                    }
+
+                    case 0x6: // VF = Vx & 1, then Vx >>= 1
+                    case 0xE: // VF = Vx >> 7, then Vx <<= 1
+                    {
+                        bool right = (opcode & 0x000Fu) == 0x6;
+                        if (quirks.shiftReadsVy)
+                        {
+                            // Vx = Vy shifted, then VF = the bit shifted out
+                            e.Op({0x8A}, AL, Read(y));
+                            e.Bytes({0x88, 0xC2}); // mov dl, al
+                            ShiftedOut(right);
+                            e.Bytes({0xD0, static_cast<uint8_t>(right ? 0xE8 : 0xE0)}); // shr/shl al, 1
+                            Move(x, Register(AL));
+                            Move(VF, Register(DL));
+                            break;
+                        }
+                        e.Op({0x8A}, DL, Read(x));
+                        ShiftedOut(right);
+                        Move(VF, Register(DL));
+                        e.Op({0x8A}, AL, Read(x));
+                        e.Bytes({0xD0, static_cast<uint8_t>(right ? 0xE8 : 0xE0)}); // shr/shl al, 1
+                        Move(x, Register(AL));
+                        break;
+                    }
+                }
+                break;
+
+            case 0xA: // I = nnn
+                e.Op({0xC7}, 0, Write(INDEX), true); // mov word I, imm16
+                e.Imm16(opcode & 0x0FFFu);
+                break;
+
+            case 0xF:
+                if (kk == 0x07) // Vx = delay timer
+                {
+                    Move(x, Memory(layout.delayTimer));
+                    break;
+                }
+                // I += Vx
+                e.Op({0x0F, 0xB6}, AL, Read(x)); // movzx eax, Vx
+                e.Op({0x01}, AL, Modify(INDEX), true); // add I, ax
+                break;
+        }
+    }
+
+    // dl = the bit a shift of dl by one moves out
+    void ShiftedOut(bool right)
+    {
+        if (right)
+        {
+            e.Bytes({0x80, 0xE2, 0x01}); // and dl, 1
+        }
+        else
+        {
+            e.Bytes({0xC0, 0xEA, 0x07}); // shr dl, 7
+        }
+    }
+
+    // Jump to the block at target, or back to the caller if there is none
+    void Link(uint16_t target)
+    {
+        StoreWord(layout.pc, target);
+        if ((target & 1u) == 0 && target + 1u < JIT_CODE_SIZE)
+        {
+            e.Bytes({0xFF, 0x25}); // jmp [rip + table entry]
+            e.Rel32(reinterpret_cast<const uint8_t*>(&table[target >> 1]));
+        }
+        else
+        {
+            e.Jump(exit);
+        }
+    }
+
+    // Last instruction of the block, a jump or skip that is never interpreted
+    void Branch(uint16_t opcode, uint16_t address)
+    {
+        uint8_t x = (opcode & 0x0F00u) >> 8u;
+        uint8_t y = (opcode & 0x00F0u) >> 4u;
+
+        Spill();
+        StoreWord(layout.opcode, opcode);
+
+        if ((opcode >> 12) == 0x1)
+        {
+            Link(opcode & 0x0FFFu);
+            return;
+        }
+
+        // The interpreter skips on Vx == kk for 3xkk, otherwise when the two differ
+        if ((opcode >> 12) == 0x3 || (opcode >> 12) == 0x4)
+        {
+            e.Op({0x80}, 7, Read(x)); // cmp Vx, kk
+            e.Byte(opcode & 0x00FFu);
+        }
+        else
+        {
+            Operand left = Read(x);
+            Operand right = Read(y);
+            if (left.memory)
+            {
+                e.Op({0x8A}, AL, left);
+                left = Register(AL);
+            }
+            e.Op({0x3A}, left.reg, right); // cmp Vx, Vy
+        }
+
+        size_t skip = e.JumpForward(((opcode >> 12) == 0x3) ? EQUAL : NOT_EQUAL);
+        Link(address + 2);
+        e.Land(skip);
+        Link(address + 4);
+    }
+
+    // Hand one instruction to the interpreter, pc pointing past it as the handler expects
+    void Call(uint16_t address, const void* instruction, JitCache::Fallback fallback)
+    {
+        Spill();
+        memset(loaded, 0, sizeof(loaded)); // The handler may change any of them, and clobbers the caller-saved registers
+
+        StoreWord(layout.pc, address + 2);
+#ifdef _WIN32
+        e.Bytes({0x48, 0x89, 0xD9}); // mov rcx, rbx
+        e.Bytes({0x48, 0xBA}); // mov rdx, instruction
+#else
+        e.Bytes({0x48, 0x89, 0xDF}); // mov rdi, rbx
+        e.Bytes({0x48, 0xBE}); // mov rsi, instruction
+#endif
+        e.Imm64(reinterpret_cast<uint64_t>(instruction));
+        e.Bytes({0x48, 0xB8}); // mov rax, fallback
+        e.Imm64(reinterpret_cast<uint64_t>(fallback));
+        e.Bytes({0xFF, 0xD0}); // call rax
+    }
+
+    void Dispatch() { e.Jump(dispatch); } // Continue at whatever pc the interpreter left
+
+private:
+    Emitter& e;
+    const JitCache::Layout& layout;
+    const Quirks& quirks;
+    const uint8_t* const* table;
+    const uint8_t* exit;
+    const uint8_t* dispatch;
+
+    int8_t host[GUESTS]; // Host register of each guest, -1 if it stays in memory
+    bool loaded[GUESTS]{}; // Host register holds the guest's value
+    bool dirty[GUESTS]{}; // Host register is newer than memory
+};
+
+// Entry, exit and dispatch stubs shared by every block. Enter(machine, budget, code) saves the callee-saved registers
+// and jumps to code; the exit stub restores them and returns the instructions run; the dispatch stub continues at pc
+static void EmitStubs(Emitter& e, const JitCache::Layout& layout, const uint8_t* const* table, size_t& exitStub,
+                      size_t& dispatchStub)
+{
+#ifdef _WIN32
+    e.Bytes({0x53, 0x55, 0x56, 0x57, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx, rbp, rsi, rdi, r12-r15
+    e.Bytes({0x48, 0x83, 0xEC, 0x28}); // sub rsp, 40 (shadow space and the budget, keeping rsp 16-byte aligned)
+    e.Bytes({0x48, 0x89, 0xCB}); // mov rbx, rcx
+    e.Bytes({0x41, 0x89, 0xD7}); // mov r15d, edx
+    e.Bytes({0x89, 0x54, 0x24, 0x20}); // mov [rsp+32], edx
+    e.Bytes({0x41, 0xFF, 0xE0}); // jmp r8
+#else
+    e.Bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx, rbp, r12-r15
+    e.Bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8 (the budget, keeping rsp 16-byte aligned)
+    e.Bytes({0x48, 0x89, 0xFB}); // mov rbx, rdi
+    e.Bytes({0x41, 0x89, 0xF7}); // mov r15d, esi
+    e.Bytes({0x89, 0x34, 0x24}); // mov [rsp], esi
+    e.Bytes({0xFF, 0xE2}); // jmp rdx
+#endif
+
+    exitStub = e.size;
+#ifdef _WIN32
+    e.Bytes({0x8B, 0x44, 0x24, 0x20}); // mov eax, [rsp+32]
+    e.Bytes({0x44, 0x29, 0xF8}); // sub eax, r15d
+    e.Bytes({0x48, 0x83, 0xC4, 0x28}); // add rsp, 40
+    e.Bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5F, 0x5E, 0x5D, 0x5B}); // pop r15-r12, rdi, rsi, rbp, rbx
+#else
+    e.Bytes({0x8B, 0x04, 0x24}); // mov eax, [rsp]
+    e.Bytes({0x44, 0x29, 0xF8}); // sub eax, r15d
+    e.Bytes({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+    e.Bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B}); // pop r15-r12, rbp, rbx
+#endif
+    e.Byte(0xC3); // ret
+
+    // Back to the caller once code was written, or when pc has no table entry
+    dispatchStub = e.size;
+    const uint8_t* exit = e.code + exitStub;
+    e.Op({0x80}, 7, Memory(layout.stale)); // cmp byte stale, 0
+    e.Byte(0);
+    e.JumpIf(NOT_EQUAL, exit);
+    e.Op({0x0F, 0xB7}, AL, Memory(layout.pc)); // movzx eax, pc
+    e.Bytes({0xA8, 0x01}); // test al, 1
+    e.JumpIf(NOT_EQUAL, exit);
+    e.Byte(0x3D); e.Imm32(JIT_CODE_SIZE - 1); // cmp eax, JIT_CODE_SIZE - 1
+    e.JumpIf(ABOVE_OR_EQUAL, exit);
+    e.Bytes({0x48, 0x8D, 0x15}); // lea rdx, [rip + table]
+    e.Rel32(reinterpret_cast<const uint8_t*>(table));
+    e.Bytes({0xFF, 0x24, 0x82}); // jmp [rdx + rax*4], the entry of the even address pc
+}
+
+#endif
+
+JitCache::JitCache()
+: generation(nextGeneration++)
+{}
+
+JitCache::JitCache(const JitCache&)
+: generation(nextGeneration++)
+{}
+
+JitCache& JitCache::operator=(const JitCache&)
+{
+    Reset();
+    return *this;
+}
+
+JitCache::~JitCache()
+{
+#ifdef JIT_X64
+    if (buffer)
+    {
+    #ifdef _WIN32
+        VirtualFree(buffer, 0, MEM_RELEASE);
+    #else
+        munmap(buffer, JIT_BUFFER_SIZE);
+    #endif
+    }
+#endif
+}
+
+bool JitCache::Supported()
+{
+#ifdef JIT_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool JitCache::CanCompile(uint16_t opcode, const Quirks& quirks)
+{
+    switch (opcode >> 12)
+    {
+        case 0x6:
+        case 0x7:
+        case 0xA:
+            return true;
+        case 0x8:
+        {
+            uint8_t n = opcode & 0x000Fu;
+            return n <= 0x7 || n == 0xE;
+        }
+        case 0xF:
+            return (opcode & 0x00FFu) == 0x07 || (opcode & 0x00FFu) == 0x1E;
+        default:
+            return Branches(opcode, quirks);
+    }
+}
+
+void JitCache::Protect(size_t from, size_t to, bool writable)
+{
+#ifdef JIT_X64
+    size_t first = (JIT_TABLE_BYTES + from) & ~(JIT_PAGE_SIZE - 1);
+    size_t last = (JIT_TABLE_BYTES + to + JIT_PAGE_SIZE - 1) & ~(JIT_PAGE_SIZE - 1);
+    #ifdef _WIN32
+        DWORD old;
+        VirtualProtect(buffer + first, last - first, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old);
+    #else
+        mprotect(buffer + first, last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+    #endif
+#else
+    (void)from;
+    (void)to;
+    (void)writable;
+#endif
+}
+
+JitCache::NativeBlock JitCache::Compile(uint16_t address, const uint16_t* opcodes, const void* const* instructions,
+                                        unsigned int count, const Layout& layout, const Quirks& quirks, Fallback fallback)
+{
+#ifdef JIT_X64
+    if (count == 0 || count > JIT_MAX_INSTRUCTIONS)
+    {
+        return nullptr;
+    }
+
+    if (!buffer)
+    {
+    #ifdef _WIN32
+        buffer = static_cast<uint8_t*>(VirtualAlloc(nullptr, JIT_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    #else
+        void* memory = mmap(nullptr, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        buffer = (memory == MAP_FAILED) ? nullptr : static_cast<uint8_t*>(memory);
+    #endif
+
+        // No memory on this host, the interpreter handles everything
+        if (!buffer)
+        {
+            return nullptr;
+        }
+
+        Emitter e(buffer + JIT_TABLE_BYTES);
+        EmitStubs(e, layout, reinterpret_cast<const uint8_t* const*>(buffer), exitStub, dispatchStub);
+        stubs = e.size;
+        Protect(0, stubs, false);
+        Reset();
+    }
+
+    // Out of space, start over (the caller sees the new generation and recompiles)
+    if (JIT_TABLE_BYTES + used + JIT_MAX_BLOCK_SIZE > JIT_BUFFER_SIZE)
+    {
+        Reset();
+    }
+
+    const uint8_t** table = reinterpret_cast<const uint8_t**>(buffer);
+    uint8_t* code = buffer + JIT_TABLE_BYTES;
+    Protect(used, used + JIT_MAX_BLOCK_SIZE, true);
+
+    // Whole blocks or nothing: enter only if the budget covers every instruction
+    Emitter e(code + used);
+    e.Bytes({0x41, 0x81, 0xFF}); e.Imm32(count); // cmp r15d, count
+    e.JumpIf(BELOW, code + exitStub);
+    e.Bytes({0x41, 0x81, 0xEF}); e.Imm32(count); // sub r15d, count
+
+    unsigned int uses[GUESTS]{};
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (CanCompile(opcodes[i], quirks))
+        {
+            CountUses(opcodes[i], quirks, uses);
+        }
+    }
+
+    Translator t(e, layout, quirks, table, code + exitStub, code + dispatchStub);
+    t.Allocate(uses);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        uint16_t opcode = opcodes[i];
+        uint16_t at = address + 2 * i;
+        bool last = i + 1 == count;
+
+        // Jumps and skips only end blocks; anywhere else the interpreter runs them in sequence too
+        if (last && Branches(opcode, quirks))
+        {
+            t.Branch(opcode, at);
+        }
+        else if (CanCompile(opcode, quirks) && !Branches(opcode, quirks))
+        {
+            t.Instruction(opcode);
+            if (last) // Cut short at the end of the code, carry on past it
+            {
+                t.Spill();
+                t.StoreWord(layout.opcode, opcode);
+                t.Link(at + 2);
+            }
+        }
+        else
+        {
+            t.Call(at, instructions[i], fallback);
+            if (last)
+            {
+                t.Dispatch();
+            }
+        }
+    }
+
+    Protect(used, used + JIT_MAX_BLOCK_SIZE, false);
+
+    NativeBlock block = code + used;
+    table[address >> 1] = block;
+    used += e.size;
+    return block;
+#else
+    (void)address;
+    (void)opcodes;
+    (void)instructions;
+    (void)count;
+    (void)layout;
+    (void)quirks;
+    (void)fallback;
+    return nullptr;
+#endif
+}
+
+unsigned int JitCache::Run(void* machine, NativeBlock block, unsigned int budget)
+{
+#ifdef JIT_X64
+    typedef unsigned int (*Enter)(void* machine, unsigned int budget, const uint8_t* code);
+    return reinterpret_cast<Enter>(buffer + JIT_TABLE_BYTES)(machine, budget, block);
+#else
+    (void)machine;
+    (void)block;
+    (void)budget;
+    return 0;
+#endif
+}
+
+void JitCache::Reset()
+{
+    // Every jump into the old code now goes back to the caller
+    if (buffer)
+    {
+        const uint8_t** table = reinterpret_cast<const uint8_t**>(buffer);
+        for (size_t i = 0; i < JIT_CODE_SIZE / 2; i++)
+        {
+            table[i] = buffer + JIT_TABLE_BYTES + exitStub;
+        }
+    }
+
+    used = stubs;
+    generation = nextGeneration++;
+}
@@ -0,0 +1,68 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <cstddef>
+#include "Quirks.hpp"
+
+// Translates whole basic blocks of CHIP-8 code into x86-64 machine code.
+// Register instructions (6xkk, 7xkk, 8xyN, Annn, Fx07, Fx1E) and the jumps and skips that end most blocks run natively,
+// with the V registers and I a block uses kept in host registers; everything else, including Dxyn, Fx0A and the
+// timer writes, is handed to the interpreter through a call, spilling the registers around it. Blocks jump straight
+// into the next compiled block until the budget runs out, so hot loops never come back to the C++ side.
+// The generated code is never writable and executable at once: pages are made writable to emit into, then executable.
+class JitCache
+{
+public:
+    // Entry point of a compiled block
+    typedef const uint8_t* NativeBlock;
+
+    // Runs one instruction the JIT has no translation for: machine is what Run() was given, instruction what Compile()
+    // was given for it. pc already points past the instruction
+    typedef void (*Fallback)(void* machine, const void* instruction);
+
+    // Byte offsets of the state generated code works on, from the machine pointer
+    struct Layout{
+        ptrdiff_t registers; // V0-VF, bytes
+        ptrdiff_t index; // I, 16 bits
+        ptrdiff_t pc; // 16 bits
+        ptrdiff_t opcode; // 16 bits, the last instruction executed
+        ptrdiff_t delayTimer; // Byte
+        ptrdiff_t stale; // Byte, nonzero once code was written and every compiled block may be out of date
+    };
+
+    JitCache();
+    JitCache(const JitCache& other); // Copies start with an empty cache, compiled code is never shared
+    JitCache& operator=(const JitCache& other);
+    ~JitCache();
+
+    // Compile the block of count instructions at address, opcodes[i] decoded as instructions[i]; nullptr if it is too
+    // long or this host cannot run generated code. quirks is the variant to follow, layout the same on every call.
+    // Later blocks jumping to address enter the new code directly
+    NativeBlock Compile(uint16_t address, const uint16_t* opcodes, const void* const* instructions, unsigned int count,
+                        const Layout& layout, const Quirks& quirks, Fallback fallback);
+
+    // Run block and the compiled blocks it leads to for at most budget instructions, whole blocks only.
+    // Returns the instructions executed, 0 when block alone does not fit in budget
+    unsigned int Run(void* machine, NativeBlock block, unsigned int budget);
+
+    // Throw away all compiled code
+    void Reset();
+
+    static bool Supported(); // Whether this build and host can run generated code
+    static bool CanCompile(uint16_t opcode, const Quirks& quirks); // Whether an opcode runs natively rather than through the fallback
+    size_t CodeBytes() const { return used; } // Executable memory holding generated code
+
+    uint32_t generation; // Changes whenever previously returned code becomes invalid
+
+private:
+    void Protect(size_t from, size_t to, bool writable); // Flip code bytes [from, to) between writable and executable
+
+    uint8_t* buffer{}; // Table of block entry points, then the code; allocated on first use
+    size_t exitStub{}; // Offsets into the code of the stubs every block jumps to
+    size_t dispatchStub{};
+    size_t stubs{}; // Bytes of code taken by the entry, exit and dispatch stubs
+    size_t used{}; // Bytes of code holding stubs and blocks
+};
+
+#endif
@@ -0,0 +1,692 @@
+#include "Lockstep.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+#endif
+
+using namespace std;
+
+const size_t WORDS_PER_LANE = CODE_SIZE / 2 / 64; // uint64_t words in a lane's divergence bitset
+
+// Vector operations the kernels are written in, one implementation per instruction set.
+// Vec holds VEC_LANES lanes of 8-bit registers, Vec16 holds half as many lanes of 16-bit registers (pc, I).
+#if defined(__AVX2__)
+
+typedef __m256i Vec;
+typedef __m256i Vec16;
+const size_t VEC_LANES = 32;
+static inline Vec LoadVec(const uint8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+static inline void StoreVec(uint8_t* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+static inline Vec Set1(uint8_t b) { return _mm256_set1_epi8(static_cast<char>(b)); }
+static inline Vec Add(Vec a, Vec b) { return _mm256_add_epi8(a, b); }
+static inline Vec Sub(Vec a, Vec b) { return _mm256_sub_epi8(a, b); }
+static inline Vec AddSat(Vec a, Vec b) { return _mm256_adds_epu8(a, b); }
+static inline Vec SubSat(Vec a, Vec b) { return _mm256_subs_epu8(a, b); }
+static inline Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+static inline Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+static inline Vec Xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+static inline Vec Equal(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Vec Select(Vec m, Vec a, Vec b) { return _mm256_blendv_epi8(b, a, m); } // m ? a : b
+static inline Vec ShiftRight(Vec a, int bits) { return And(_mm256_srli_epi16(a, bits), Set1(0xFFu >> bits)); }
+
+static inline Vec16 Load16(const uint16_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+static inline void Store16(uint16_t* p, Vec16 v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+static inline Vec16 Set16(uint16_t w) { return _mm256_set1_epi16(static_cast<short>(w)); }
+static inline Vec16 Add16(Vec16 a, Vec16 b) { return _mm256_add_epi16(a, b); }
+static inline Vec16 Widen(Vec v, int half) { return _mm256_cvtepu8_epi16(half ? _mm256_extracti128_si256(v, 1) : _mm256_castsi256_si128(v)); } // Zero-extend
+static inline Vec16 WidenMask(Vec m, int half) { return _mm256_cvtepi8_epi16(half ? _mm256_extracti128_si256(m, 1) : _mm256_castsi256_si128(m)); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+typedef __m128i Vec;
+typedef __m128i Vec16;
+const size_t VEC_LANES = 16;
+static inline Vec LoadVec(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+static inline void StoreVec(uint8_t* p, Vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+static inline Vec Set1(uint8_t b) { return _mm_set1_epi8(static_cast<char>(b)); }
+static inline Vec Add(Vec a, Vec b) { return _mm_add_epi8(a, b); }
+static inline Vec Sub(Vec a, Vec b) { return _mm_sub_epi8(a, b); }
+static inline Vec AddSat(Vec a, Vec b) { return _mm_adds_epu8(a, b); }
+static inline Vec SubSat(Vec a, Vec b) { return _mm_subs_epu8(a, b); }
+static inline Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+static inline Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+static inline Vec Xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+static inline Vec Equal(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline Vec Select(Vec m, Vec a, Vec b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+static inline Vec ShiftRight(Vec a, int bits) { return And(_mm_srli_epi16(a, bits), Set1(0xFFu >> bits)); }
+
+static inline Vec16 Load16(const uint16_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+static inline void Store16(uint16_t* p, Vec16 v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+static inline Vec16 Set16(uint16_t w) { return _mm_set1_epi16(static_cast<short>(w)); }
+static inline Vec16 Add16(Vec16 a, Vec16 b) { return _mm_add_epi16(a, b); }
+static inline Vec16 Widen(Vec v, int half) { return half ? _mm_unpackhi_epi8(v, _mm_setzero_si128()) : _mm_unpacklo_epi8(v, _mm_setzero_si128()); }
+static inline Vec16 WidenMask(Vec m, int half) { return half ? _mm_unpackhi_epi8(m, m) : _mm_unpacklo_epi8(m, m); }
+
+#else
+
+// No SIMD on this target: plain loops over the same lane counts as SSE2
+struct Vec { uint8_t b[16]; };
+struct Vec16 { uint16_t w[8]; };
+const size_t VEC_LANES = 16;
+
+#define LANEWISE(type, count, expression) type r; for (size_t i = 0; i < count; i++) { r.expression; } return r;
+static inline Vec LoadVec(const uint8_t* p) { Vec r; memcpy(r.b, p, sizeof(r.b)); return r; }
+static inline void StoreVec(uint8_t* p, Vec v) { memcpy(p, v.b, sizeof(v.b)); }
+static inline Vec Set1(uint8_t b) { LANEWISE(Vec, 16, b[i] = b) }
+static inline Vec Add(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = a.b[i] + b.b[i]) }
+static inline Vec Sub(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = a.b[i] - b.b[i]) }
+static inline Vec AddSat(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = min(a.b[i] + b.b[i], 0xFF)) }
+static inline Vec SubSat(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = max(a.b[i] - b.b[i], 0)) }
+static inline Vec And(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = a.b[i] & b.b[i]) }
+static inline Vec Or(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = a.b[i] | b.b[i]) }
+static inline Vec Xor(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = a.b[i] ^ b.b[i]) }
+static inline Vec Equal(Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = (a.b[i] == b.b[i]) ? 0xFF : 0x00) }
+static inline Vec Select(Vec m, Vec a, Vec b) { LANEWISE(Vec, 16, b[i] = m.b[i] ? a.b[i] : b.b[i]) }
+static inline Vec ShiftRight(Vec a, int bits) { LANEWISE(Vec, 16, b[i] = a.b[i] >> bits) }
+
+static inline Vec16 Load16(const uint16_t* p) { Vec16 r; memcpy(r.w, p, sizeof(r.w)); return r; }
+static inline void Store16(uint16_t* p, Vec16 v) { memcpy(p, v.w, sizeof(v.w)); }
+static inline Vec16 Set16(uint16_t w) { LANEWISE(Vec16, 8, w[i] = w) }
+static inline Vec16 Add16(Vec16 a, Vec16 b) { LANEWISE(Vec16, 8, w[i] = a.w[i] + b.w[i]) }
+static inline Vec16 Widen(Vec v, int half) { LANEWISE(Vec16, 8, w[i] = v.b[half * 8 + i]) }
+static inline Vec16 WidenMask(Vec m, int half) { LANEWISE(Vec16, 8, w[i] = m.b[half * 8 + i] ? 0xFFFF : 0x0000) }
+static inline Vec16 Select(Vec16 m, Vec16 a, Vec16 b) { LANEWISE(Vec16, 8, w[i] = m.w[i] ? a.w[i] : b.w[i]) }
+#undef LANEWISE
+
+#endif
+
+const size_t VEC16_LANES = VEC_LANES / 2;
+
+static inline Vec Not(Vec a) { return Xor(a, Set1(0xFF)); }
+static inline Vec Greater(Vec a, Vec b) { return Not(Equal(SubSat(a, b), Set1(0))); } // Unsigned a > b
+
+// Add the zero-extended bytes of step to the 16-bit values of the same lanes
+static inline void AddBytes(uint16_t* p, Vec step)
+{
+    Store16(p, Add16(Load16(p), Widen(step, 0)));
+    Store16(p + VEC16_LANES, Add16(Load16(p + VEC16_LANES), Widen(step, 1)));
+}
+
+// Replace the 16-bit values of the selected lanes with value
+static inline void Assign16(uint16_t* p, Vec m, uint16_t value)
+{
+    Store16(p, Select(WidenMask(m, 0), Set16(value), Load16(p)));
+    Store16(p + VEC16_LANES, Select(WidenMask(m, 1), Set16(value), Load16(p + VEC16_LANES)));
+}
+
+// Run kernel(i) for every vector of lanes starting at i in [begin, end)
+template <typename Kernel>
+static inline void ForVectors(size_t begin, size_t end, Kernel kernel)
+{
+    for (size_t i = begin; i < end; i += VEC_LANES)
+    {
+        kernel(i);
+    }
+}
+
+const char* Lockstep::InstructionSet()
+{
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+Lockstep::Lockstep(size_t lanes, const Chip8& start, unsigned int cpuHz, unsigned int timerHz)
+: cpuHz(max(cpuHz, 1u)), timerHz(max(timerHz, 1u)), lanes(lanes), quirks(start.quirks)
+{
+    stride = max<size_t>((lanes + VEC_LANES - 1) / VEC_LANES * VEC_LANES, VEC_LANES);
+
+    registers.resize(16 * stride);
+    index.resize(stride);
+    pc.resize(stride);
+    delayTimer.resize(stride);
+    soundTimer.resize(stride);
+    mask.resize(stride);
+    allLanes.resize(stride);
+    fill(allLanes.begin(), allLanes.begin() + lanes, 0xFF);
+
+    memcpy(image, start.memory, sizeof(image));
+    divergentLanes.resize(CODE_SIZE / 2);
+    divergentWords.resize(lanes * WORDS_PER_LANE);
+
+    decoded.resize(CODE_SIZE);
+    groupHead.resize(CODE_SIZE);
+    groupStamp.resize(CODE_SIZE);
+    nextInGroup.resize(lanes);
+
+    machines.resize(lanes, start);
+    for (size_t lane = 0; lane < lanes; lane++)
+    {
+        Load(lane, machines[lane]);
+    }
+}
+
+void Lockstep::Load(size_t lane, const Chip8& chip8)
+{
+    if (&machines[lane] != &chip8)
+    {
+        machines[lane] = chip8;
+    }
+
+    for (unsigned int r = 0; r < 16; r++)
+    {
+        registers[r * stride + lane] = chip8.registers[r];
+    }
+    index[lane] = chip8.index;
+    pc[lane] = chip8.pc;
+    delayTimer[lane] = chip8.delayTimer;
+    soundTimer[lane] = chip8.soundTimer;
+
+    MarkWritten(lane, 0, CODE_SIZE);
+}
+
+void Lockstep::Store(size_t lane, Chip8& chip8) const
+{
+    chip8 = machines[lane];
+
+    for (unsigned int r = 0; r < 16; r++)
+    {
+        chip8.registers[r] = registers[r * stride + lane];
+    }
+    chip8.index = index[lane];
+    chip8.pc = pc[lane];
+    chip8.delayTimer = delayTimer[lane];
+    chip8.soundTimer = soundTimer[lane];
+}
+
+void Lockstep::MarkWritten(size_t lane, unsigned int address, unsigned int length)
+{
+    // Writes running past the top of memory wrap around to address 0
+    if (address + length > MEMORY_SIZE)
+    {
+        MarkWritten(lane, 0, address + length - MEMORY_SIZE);
+        length = MEMORY_SIZE - address;
+    }
+
+    const uint8_t* memory = machines[lane].memory;
+    unsigned int end = min<unsigned int>(address + length, CODE_SIZE);
+
+    for (unsigned int word = address / 2; word * 2 < end; word++)
+    {
+        bool differs = memcmp(&memory[word * 2], &image[word * 2], 2) != 0;
+        uint64_t& bits = divergentWords[lane * WORDS_PER_LANE + word / 64];
+        uint64_t bit = 1ull << (word % 64);
+
+        if (differs != ((bits & bit) != 0))
+        {
+            bits ^= bit;
+            divergentLanes[word] += differs ? 1 : -1;
+        }
+    }
+}
+
+bool Lockstep::Shared(uint16_t address) const
+{
+    // An opcode at an odd address spans two words
+    return divergentLanes[address >> 1] == 0 && divergentLanes[(address + 1u) >> 1] == 0;
+}
+
+uint16_t Lockstep::Fetch(size_t lane, uint16_t address) const
+{
+    const uint8_t* memory = Shared(address) ? image : machines[lane].memory;
+    return (memory[address] << 8u) | memory[address + 1];
+}
+
+void Lockstep::ExecuteScalar(size_t lane)
+{
+    Chip8& chip8 = machines[lane];
+
+    for (unsigned int r = 0; r < 16; r++)
+    {
+        chip8.registers[r] = registers[r * stride + lane];
+    }
+    chip8.index = index[lane];
+    chip8.pc = pc[lane];
+    chip8.delayTimer = delayTimer[lane];
+    chip8.soundTimer = soundTimer[lane];
+
+    uint16_t indexBefore = chip8.index;
+
+    // Shared code uses the shared decoded instruction, which stays warm in cache unlike each lane's icache
+    uint16_t address = pc[lane];
+    if (address < CODE_SIZE - 1 && Shared(address))
+    {
+        Chip8::Instruction& instruction = decoded[address];
+        if (instruction.handler == nullptr)
+        {
+            instruction = Chip8::Decode((image[address] << 8u) | image[address + 1], quirks);
+        }
+
+        // Same steps as Chip8::Cycle
+        chip8.op = &instruction;
+        chip8.opcode = instruction.opcode;
+        chip8.pc += 2;
+        instruction.handler(chip8);
+    }
+    else
+    {
+        chip8.Cycle();
+    }
+
+    for (unsigned int r = 0; r < 16; r++)
+    {
+        registers[r * stride + lane] = chip8.registers[r];
+    }
+    index[lane] = chip8.index;
+    pc[lane] = chip8.pc;
+    delayTimer[lane] = chip8.delayTimer;
+    soundTimer[lane] = chip8.soundTimer;
+
+    // Fx33, Fx55 and 5xy2 are the only instructions that write memory
+    if ((chip8.opcode & 0xF0FFu) == 0xF033u)
+    {
+        MarkWritten(lane, indexBefore, 3);
+    }
+    else if ((chip8.opcode & 0xF0FFu) == 0xF055u)
+    {
+        MarkWritten(lane, indexBefore, ((chip8.opcode & 0x0F00u) >> 8u) + 1);
+    }
+    else if ((chip8.opcode & 0xF00Fu) == 0x5002u)
+    {
+        unsigned int x = (chip8.opcode & 0x0F00u) >> 8u;
+        unsigned int y = (chip8.opcode & 0x00F0u) >> 4u;
+        MarkWritten(lane, indexBefore, (x <= y ? y - x : x - y) + 1);
+    }
+
+    scalarLanes++;
+}
+
+bool Lockstep::Vectorizable(uint16_t address, uint16_t opcode) const
+{
+    // The skip kernels step over one word; an F000 nnnn after them needs two under XO-CHIP, so those skips run scalar
+    bool skipsOneWord = !QuirksOf(quirks).skipsLongLoad
+        || (address + 3u < CODE_SIZE && Shared(address + 2) && (image[address + 2] != 0xF0 || image[address + 3] != 0x00));
+
+    switch (opcode >> 12)
+    {
+        case 0x1:
+        case 0x6:
+        case 0x7:
+        case 0xA:
+            return true;
+        case 0x3:
+        case 0x4:
+            return skipsOneWord;
+        case 0x5:
+        case 0x9:
+            return (opcode & 0x000Fu) == 0 && skipsOneWord;
+        case 0x8:
+        {
+            uint8_t n = opcode & 0x000Fu;
+            return n <= 0x7 || n == 0xE;
+        }
+        case 0xF:
+        {
+            uint8_t kk = opcode & 0x00FFu;
+            return kk == 0x07 || kk == 0x15 || kk == 0x18 || kk == 0x1E;
+        }
+        default:
+            return false;
+    }
+}
+
+void Lockstep::ExecuteVector(uint16_t opcode, const uint8_t* select, size_t begin, size_t end)
+{
+    uint8_t* Vx = Register((opcode & 0x0F00u) >> 8u);
+    uint8_t* Vy = Register((opcode & 0x00F0u) >> 4u);
+    uint8_t* VF = Register(0xF);
+    uint8_t kk = opcode & 0x00FFu;
+    uint16_t nnn = opcode & 0x0FFFu;
+    const Vec one = Set1(1);
+    const Vec two = Set1(2);
+    const Quirks& variant = QuirksOf(quirks);
+    uint8_t* shifted = variant.shiftReadsVy ? Vy : Vx; // Register 8xy6 and 8xyE shift
+
+    // Every kernel moves the selected lanes past the instruction, as in Chip8::Cycle, and mirrors its
+    // OPCODE_ handler's order of reads and writes, so x or y being F behaves the same
+    switch (opcode >> 12)
+    {
+        case 0x1:
+            ForVectors(begin, end, [&](size_t i) {
+                Assign16(&pc[i], LoadVec(&select[i]), nnn);
+            });
+            break;
+
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        {
+            // Skipping lanes move 4 bytes instead of 2; 5xy0 skips on inequality like OPCODE_5xy0
+            bool immediate = (opcode >> 12) == 0x3 || (opcode >> 12) == 0x4;
+            bool skipEqual = (opcode >> 12) == 0x3;
+            ForVectors(begin, end, [&](size_t i) {
+                Vec m = LoadVec(&select[i]);
+                Vec same = Equal(LoadVec(Vx + i), immediate ? Set1(kk) : LoadVec(Vy + i));
+                Vec skip = And(m, skipEqual ? same : Not(same));
+                AddBytes(&pc[i], Add(And(m, two), And(skip, two)));
+            });
+            break;
+        }
+
+        case 0x6:
+            ForVectors(begin, end, [&](size_t i) {
+                Vec m = LoadVec(&select[i]);
+                StoreVec(Vx + i, Select(m, Set1(kk), LoadVec(Vx + i)));
+                AddBytes(&pc[i], And(m, two));
+            });
+            break;
+
+        case 0x7:
+            ForVectors(begin, end, [&](size_t i) {
+                Vec m = LoadVec(&select[i]);
+                Vec x = LoadVec(Vx + i);
+                StoreVec(Vx + i, Select(m, Add(x, Set1(kk)), x));
+                AddBytes(&pc[i], And(m, two));
+            });
+            break;
+
+        case 0x8:
+            switch (opcode & 0x000Fu)
+            {
+                case 0x0:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(Vx + i, Select(m, LoadVec(Vy + i), LoadVec(Vx + i)));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x1:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        Vec x = LoadVec(Vx + i);
+                        StoreVec(Vx + i, Select(m, Or(x, LoadVec(Vy + i)), x));
+                        if (variant.logicResetsVf)
+                        {
+                            StoreVec(VF + i, Select(m, Set1(0), LoadVec(VF + i)));
+                        }
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x2:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        Vec x = LoadVec(Vx + i);
+                        StoreVec(Vx + i, Select(m, And(x, LoadVec(Vy + i)), x));
+                        if (variant.logicResetsVf)
+                        {
+                            StoreVec(VF + i, Select(m, Set1(0), LoadVec(VF + i)));
+                        }
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x3:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        Vec x = LoadVec(Vx + i);
+                        StoreVec(Vx + i, Select(m, Xor(x, LoadVec(Vy + i)), x));
+                        if (variant.logicResetsVf)
+                        {
+                            StoreVec(VF + i, Select(m, Set1(0), LoadVec(VF + i)));
+                        }
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x4:
+                    ForVectors(begin, end, [&](size_t i) {
+                        // Sum from the old values, carry set when the saturating sum differs from the wrapping one
+                        Vec m = LoadVec(&select[i]);
+                        Vec x = LoadVec(Vx + i);
+                        Vec y = LoadVec(Vy + i);
+                        Vec sum = Add(x, y);
+                        StoreVec(VF + i, Select(m, And(Not(Equal(AddSat(x, y), sum)), one), LoadVec(VF + i)));
+                        StoreVec(Vx + i, Select(m, sum, LoadVec(Vx + i)));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x5:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(VF + i, Select(m, And(Greater(LoadVec(Vx + i), LoadVec(Vy + i)), one), LoadVec(VF + i)));
+                        Vec x = LoadVec(Vx + i);
+                        StoreVec(Vx + i, Select(m, Sub(x, LoadVec(Vy + i)), x));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x6:
+                    if (variant.shiftReadsVy)
+                    {
+                        // Result first and flag last, like the quirked OPCODE_8xy6
+                        ForVectors(begin, end, [&](size_t i) {
+                            Vec m = LoadVec(&select[i]);
+                            Vec y = LoadVec(shifted + i);
+                            StoreVec(Vx + i, Select(m, ShiftRight(y, 1), LoadVec(Vx + i)));
+                            StoreVec(VF + i, Select(m, And(y, one), LoadVec(VF + i)));
+                            AddBytes(&pc[i], And(m, two));
+                        });
+                        break;
+                    }
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(VF + i, Select(m, And(LoadVec(Vx + i), one), LoadVec(VF + i)));
+                        Vec x = LoadVec(Vx + i);
+                        StoreVec(Vx + i, Select(m, ShiftRight(x, 1), x));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x7:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(VF + i, Select(m, And(Greater(LoadVec(Vy + i), LoadVec(Vx + i)), one), LoadVec(VF + i)));
+                        Vec x = LoadVec(Vx + i);
+                        StoreVec(Vx + i, Select(m, Sub(LoadVec(Vy + i), x), x));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0xE:
+                    if (variant.shiftReadsVy)
+                    {
+                        ForVectors(begin, end, [&](size_t i) {
+                            Vec m = LoadVec(&select[i]);
+                            Vec y = LoadVec(shifted + i);
+                            StoreVec(Vx + i, Select(m, Add(y, y), LoadVec(Vx + i)));
+                            StoreVec(VF + i, Select(m, ShiftRight(y, 7), LoadVec(VF + i)));
+                            AddBytes(&pc[i], And(m, two));
+                        });
+                        break;
+                    }
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(VF + i, Select(m, ShiftRight(LoadVec(Vx + i), 7), LoadVec(VF + i)));
+                        Vec x = LoadVec(Vx + i);
+                        StoreVec(Vx + i, Select(m, Add(x, x), x));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+            }
+            break;
+
+        case 0xA:
+            ForVectors(begin, end, [&](size_t i) {
+                Vec m = LoadVec(&select[i]);
+                Assign16(&index[i], m, nnn);
+                AddBytes(&pc[i], And(m, two));
+            });
+            break;
+
+        case 0xF:
+            switch (kk)
+            {
+                case 0x07:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(Vx + i, Select(m, LoadVec(&delayTimer[i]), LoadVec(Vx + i)));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x15:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(&delayTimer[i], Select(m, LoadVec(Vx + i), LoadVec(&delayTimer[i])));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x18:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        StoreVec(&soundTimer[i], Select(m, LoadVec(Vx + i), LoadVec(&soundTimer[i])));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+
+                case 0x1E:
+                    ForVectors(begin, end, [&](size_t i) {
+                        Vec m = LoadVec(&select[i]);
+                        AddBytes(&index[i], And(m, LoadVec(Vx + i)));
+                        AddBytes(&pc[i], And(m, two));
+                    });
+                    break;
+            }
+            break;
+    }
+}
+
+void Lockstep::Step()
+{
+    // Common case: every lane at the same shared instruction, one kernel runs them all without grouping
+    uint16_t first = pc[0];
+    if (first < CODE_SIZE - 1 && Shared(first))
+    {
+        uint16_t different = 0;
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            different |= pc[lane] ^ first;
+        }
+
+        uint16_t opcode = Fetch(0, first);
+        if (different == 0 && Vectorizable(first, opcode))
+        {
+            ExecuteVector(opcode, allLanes.data(), 0, stride);
+            vectorLanes += lanes;
+            return;
+        }
+    }
+
+    // Group the lanes by pc, pcs whose opcode would wrap around memory go straight to their Chip8
+    stepStamp++;
+    groups.clear();
+
+    for (size_t lane = 0; lane < lanes; lane++)
+    {
+        uint16_t address = pc[lane];
+        if (address >= CODE_SIZE - 1)
+        {
+            ExecuteScalar(lane);
+            continue;
+        }
+
+        if (groupStamp[address] != stepStamp)
+        {
+            groupStamp[address] = stepStamp;
+            groupHead[address] = -1;
+            groups.push_back(address);
+        }
+
+        nextInGroup[lane] = groupHead[address];
+        groupHead[address] = static_cast<int32_t>(lane);
+    }
+
+    for (uint16_t address : groups)
+    {
+        int32_t head = groupHead[address];
+        uint16_t opcode = Fetch(head, address);
+
+        // Lanes whose copy of this code differs from the shared image may run different opcodes here
+        if (!Shared(address) || !Vectorizable(address, opcode))
+        {
+            for (int32_t lane = head; lane >= 0; lane = nextInGroup[lane])
+            {
+                ExecuteScalar(lane);
+            }
+            continue;
+        }
+
+        // Select the group, run the kernel on each vector holding some of its lanes, then clear the selection again
+        for (int32_t lane = head; lane >= 0; lane = nextInGroup[lane])
+        {
+            mask[lane] = 0xFF;
+        }
+
+        // Lists run from the highest lane down, so each vector comes up in one unbroken stretch
+        size_t lastVector = SIZE_MAX;
+        for (int32_t lane = head; lane >= 0; lane = nextInGroup[lane])
+        {
+            size_t vector = lane / VEC_LANES;
+            if (vector != lastVector)
+            {
+                ExecuteVector(opcode, mask.data(), vector * VEC_LANES, (vector + 1) * VEC_LANES);
+                lastVector = vector;
+            }
+            vectorLanes++;
+        }
+
+        for (int32_t lane = head; lane >= 0; lane = nextInGroup[lane])
+        {
+            mask[lane] = 0x00;
+        }
+    }
+}
+
+void Lockstep::TickTimers()
+{
+    const Vec one = Set1(1);
+
+    // Saturating subtraction stops every timer at zero
+    for (size_t i = 0; i < stride; i += VEC_LANES)
+    {
+        StoreVec(&delayTimer[i], SubSat(LoadVec(&delayTimer[i]), one));
+        StoreVec(&soundTimer[i], SubSat(LoadVec(&soundTimer[i]), one));
+    }
+}
+
+void Lockstep::Run(uint64_t instructions)
+{
+    uint64_t end = cycles + instructions;
+
+    while (true)
+    {
+        // Same tick schedule as Scheduler::NextTick
+        while (((timerTicks + 1) * cpuHz + timerHz - 1) / timerHz <= cycles)
+        {
+            TickTimers();
+            timerTicks++;
+        }
+
+        if (cycles == end)
+        {
+            break;
+        }
+
+        Step();
+        cycles++;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Chip8.hpp"
+using namespace std;
+
+// Many Chip8 machines running the same ROM, stepped one instruction at a time in lockstep.
+// V0-VF, I, pc and the timers are kept in structure-of-arrays form (one row per register, one column per lane).
+// Each step groups the lanes by pc. A group whose opcode only touches that state (1nnn, 3xkk, 4xkk, 5xy0, 6xkk,
+// 7xkk, 8xyN, 9xy0, Annn, Fx07, Fx15, Fx18, Fx1E) runs as masked SIMD kernels (AVX2 when the build enables it,
+// SSE2 otherwise) over the vectors holding its lanes. Everything else (draws, calls, keys, random numbers,
+// memory) runs on the lane's own Chip8, so every lane gives exactly the results of a lone Chip8.
+// Lanes that stay on the same pc run fastest; lanes scattered over many pcs cost more than separate machines.
+class Lockstep
+{
+public:
+    // lanes copies of start, running at cpuHz instructions per second with timers at timerHz, like Scheduler
+    Lockstep(size_t lanes, const Chip8& start, unsigned int cpuHz = 700, unsigned int timerHz = 60);
+
+    void Load(size_t lane, const Chip8& chip8); // Replace a lane with a copy of chip8
+    void Store(size_t lane, Chip8& chip8) const; // Copy a lane out into chip8
+
+    void Step(); // Execute one instruction on every lane
+    void TickTimers(); // Count every lane's delay and sound timers down by one
+    void Run(uint64_t instructions); // Execute instructions on every lane, ticking the timers exactly where Scheduler would
+
+    uint8_t* Keypad(size_t lane) { return machines[lane].keypad; } // Input of one lane, may be changed between steps
+    uint8_t* Register(unsigned int r) { return &registers[r * stride]; } // Vr of every lane
+    size_t Size() const { return lanes; }
+
+    static const char* InstructionSet(); // Vector instructions the kernels were built for
+
+    unsigned int cpuHz;
+    unsigned int timerHz;
+    uint64_t cycles{}; // Instructions executed per lane so far
+    uint64_t timerTicks{}; // Timer ticks delivered so far
+
+    uint64_t vectorLanes{}; // Lane-instructions executed by SIMD kernels
+    uint64_t scalarLanes{}; // Lane-instructions executed one lane at a time
+
+private:
+    bool Vectorizable(uint16_t address, uint16_t opcode) const; // Whether a kernel exists for the shared opcode at address
+    void ExecuteVector(uint16_t opcode, const uint8_t* select, size_t begin, size_t end); // Run opcode on the lanes in [begin, end) whose select byte is 0xFF
+    void ExecuteScalar(size_t lane); // Run the next instruction of one lane on its Chip8
+    void MarkWritten(size_t lane, unsigned int address, unsigned int length); // Track lane memory that no longer matches image, wrapping at the top of memory
+    bool Shared(uint16_t address) const; // Whether every lane holds image's opcode at address
+    uint16_t Fetch(size_t lane, uint16_t address) const; // Opcode at address (below CODE_SIZE - 1) as lane sees it
+
+    size_t lanes;
+    QuirkProfile quirks; // Variant of start, which every lane runs
+    size_t stride; // Lanes rounded up to whole vectors, the padding lanes are never selected
+
+    vector<uint8_t> registers; // registers[r * stride + lane] is Vr of lane
+    vector<uint16_t> index;
+    vector<uint16_t> pc;
+    vector<uint8_t> delayTimer;
+    vector<uint8_t> soundTimer;
+    vector<uint8_t> mask; // 0xFF for the lanes of the group being run, 0x00 otherwise
+    vector<uint8_t> allLanes; // 0xFF for every real lane, 0x00 for the padding
+
+    vector<Chip8> machines; // Memory, stack, screen, keypad and random numbers of every lane; their registers are stale
+
+    // Code shared by all lanes: the fetch at an address reads image unless some lane's copy of that word differs
+    uint8_t image[CODE_SIZE];
+    vector<uint16_t> divergentLanes; // Lanes whose memory differs from image, per 2-byte word
+    vector<uint64_t> divergentWords; // Bit w of lane's 32 words set when its word at 2 * w differs from image
+    vector<Chip8::Instruction> decoded; // Decoded opcode of image at every address, decoded on first use
+
+    // Lanes grouped by pc during a step, as linked lists per address
+    vector<int32_t> groupHead; // First lane of each group, valid when groupStamp matches stepStamp
+    vector<uint32_t> groupStamp;
+    vector<int32_t> nextInGroup;
+    vector<uint16_t> groups; // Addresses with a group this step
+    uint32_t stepStamp{};
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "Movie.hpp"
+#include "Rom.hpp"
+#include <fstream>
+#include <iterator>
+#include <cstring>
+using namespace std;
+
+// File layout, version 2: header then one 16-bit key mask per frame, all little-endian.
+// Version 1 lacked the quirk profile byte and always ran MODERN.
+const char MOVIE_MAGIC[4] = {'C', '8', 'M', 'V'};
+const uint8_t MOVIE_VERSION = 2;
+const size_t MOVIE_HEADER_SIZE = sizeof(MOVIE_MAGIC) + 1 + 4 + 4 + 4 + 8 + 4 + 1; // Magic, version, seed, cpuHz, timerHz, ROM hash, frame count, quirks
+
+static void PutLE(vector<uint8_t>& out, uint64_t value, unsigned int bytes)
+{
+    for (unsigned int i = 0; i < bytes; i++)
+    {
+        out.push_back((value >> (8 * i)) & 0xFFu);
+    }
+}
+
+static uint64_t GetLE(const uint8_t*& in, unsigned int bytes)
+{
+    uint64_t value = 0;
+    for (unsigned int i = 0; i < bytes; i++)
+    {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    in += bytes;
+    return value;
+}
+
+void Movie::Save(const char* filename) const
+{
+    vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+    out.push_back(MOVIE_VERSION);
+    PutLE(out, seed, 4);
+    PutLE(out, cpuHz, 4);
+    PutLE(out, timerHz, 4);
+    PutLE(out, romHash, 8);
+    PutLE(out, frames.size(), 4);
+    out.push_back(static_cast<uint8_t>(quirks));
+
+    for (uint16_t keys : frames)
+    {
+        PutLE(out, keys, 2);
+    }
+
+    ofstream file(filename, ios::binary);
+    if (!file.write(reinterpret_cast<const char*>(out.data()), out.size()))
+    {
+        throw "Could not write the movie file";
+    }
+}
+
+void Movie::Load(const char* filename)
+{
+    ifstream file(filename, ios::binary);
+    if (!file.is_open())
+    {
+        throw "Could not open the movie file";
+    }
+
+    vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    uint8_t version = data.size() > sizeof(MOVIE_MAGIC) ? data[sizeof(MOVIE_MAGIC)] : 0;
+    size_t headerSize = MOVIE_HEADER_SIZE - (version == 1 ? 1 : 0);
+    if (data.size() < headerSize || memcmp(data.data(), MOVIE_MAGIC, sizeof(MOVIE_MAGIC)) != 0
+        || version < 1 || version > MOVIE_VERSION)
+    {
+        throw "Not a movie file of this version";
+    }
+
+    const uint8_t* in = data.data() + sizeof(MOVIE_MAGIC) + 1;
+    seed = GetLE(in, 4);
+    cpuHz = GetLE(in, 4);
+    timerHz = GetLE(in, 4);
+    romHash = GetLE(in, 8);
+    uint64_t count = GetLE(in, 4);
+    quirks = QuirkProfile::MODERN;
+    if (version >= 2)
+    {
+        if (*in >= QUIRK_PROFILES)
+        {
+            throw "Unknown quirk profile in the movie file";
+        }
+        quirks = static_cast<QuirkProfile>(*in++);
+    }
+
+    if (data.size() != headerSize + 2 * count)
+    {
+        throw "Truncated movie file";
+    }
+
+    frames.resize(count);
+    for (uint16_t& keys : frames)
+    {
+        keys = GetLE(in, 2);
+    }
+}
+
+uint64_t Movie::HashROM(const char* filename)
+{
+    // Hashed when read, so hashing the ROM a run is about to load costs nothing extra
+    shared_ptr<const Rom> rom = RomCache::Get(filename);
+    if (!rom)
+    {
+        throw "Could not open the ROM";
+    }
+    return rom->Hash();
+}
+
+uint16_t Movie::KeyMask(const uint8_t* keypad)
+{
+    uint16_t mask = 0;
+    for (unsigned int k = 0; k < 16; k++)
+    {
+        mask |= (keypad[k] ? 1u : 0u) << k;
+    }
+    return mask;
+}
+
+void Movie::ApplyKeys(uint16_t mask, uint8_t* keypad)
+{
+    for (unsigned int k = 0; k < 16; k++)
+    {
+        keypad[k] = (mask >> k) & 1u;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <cstdint>
+#include <vector>
+#include "Quirks.hpp"
+using namespace std;
+
+// Recorded input of a run: everything needed, besides the ROM itself, to repeat it bit for bit.
+// Starting from a fresh Chip8 with the ROM loaded, Seed(seed) and SetQuirks(quirks), running each frame on a
+// Scheduler(cpuHz, timerHz) with keypad set from that frame's mask gives the same run again.
+class Movie
+{
+public:
+    void Save(const char* filename) const; // Throws if the file cannot be written
+    void Load(const char* filename); // Throws if the file cannot be read or is not a movie
+
+    static uint64_t HashROM(const char* filename); // 64-bit FNV-1a hash of a ROM file, throws if it cannot be read
+    static uint16_t KeyMask(const uint8_t* keypad); // Bit k set while key k is held
+    static void ApplyKeys(uint16_t mask, uint8_t* keypad);
+
+    uint32_t seed{}; // Chip8::Seed of the run
+    uint32_t cpuHz{}; // Scheduler speeds of the run
+    uint32_t timerHz{};
+    uint64_t romHash{}; // HashROM of the ROM the run was recorded with
+    QuirkProfile quirks{QuirkProfile::MODERN}; // Variant the run was emulating
+    vector<uint16_t> frames; // Key mask held during each frame
+};
+
+#endif
@@ -1,8 +1,9 @@
 #include "Platform.hpp"
 
 Platform::Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight)
+: textureWidth(textureWidth), textureHeight(textureHeight)
 {
-    SDL_Init(SDL_INIT_VIDEO);
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
     window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,textureWidth, textureHeight);
@@ -11,6 +12,10 @@ Platform::Platform(char const* title, int windowWidth, int windowHeight, int tex
 Platform::~Platform()
 {
     //Release Memory to avoid memory leak
+    if (audioDevice != 0)
+    {
+        SDL_CloseAudioDevice(audioDevice); // Waits for a running callback, so the Audio outlives its last use
+    }
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -22,6 +27,42 @@ void Platform::Update(void const* buffer, int pitch)
     // Fetch the new texture
     SDL_UpdateTexture(texture, nullptr, buffer, pitch); 
 
+    Present();
+}
+
+void Platform::Update(void const* buffer, int pitch, uint64_t rows)
+{
+    // Nothing changed, the last presented frame is still correct
+    if (rows == 0)
+    {
+        return;
+    }
+
+    // Upload each run of consecutive changed rows as one sub-rectangle
+    int y = 0;
+    while (y < textureHeight)
+    {
+        if (!((rows >> y) & 1u))
+        {
+            y++;
+            continue;
+        }
+
+        int first = y;
+        while (y < textureHeight && ((rows >> y) & 1u))
+        {
+            y++;
+        }
+
+        SDL_Rect rect{0, first, textureWidth, y - first};
+        SDL_UpdateTexture(texture, &rect, static_cast<uint8_t const*>(buffer) + first * pitch, pitch);
+    }
+
+    Present();
+}
+
+void Platform::Present()
+{
     // Clear the renderer
     SDL_RenderClear(renderer); 
 
@@ -43,6 +84,15 @@ bool Platform::ProcessInput(uint8_t* keys)
     {
         switch(event.type)
         {
+            // When the window was uncovered or resized, repaint it from the texture
+            case SDL_WINDOWEVENT:
+            {
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                {
+                    Present();
+                }
+            } break;
+
             // When exit 
             case SDL_QUIT:
             {
@@ -59,6 +109,11 @@ bool Platform::ProcessInput(uint8_t* keys)
                         quit = true;
                     } break;
 
+                    case SDLK_BACKSPACE:
+                    {
+                        rewindHeld = true;
+                    } break;
+
                     case SDLK_x:
                     {
                         keys[0] = 1;
@@ -146,6 +201,11 @@ bool Platform::ProcessInput(uint8_t* keys)
             {
                 switch (event.key.keysym.sym)
                 {
+                    case SDLK_BACKSPACE:
+                    {
+                        rewindHeld = false;
+                    } break;
+
                     case SDLK_x:
                     {
                         keys[0] = 0;
@@ -231,4 +291,31 @@ bool Platform::ProcessInput(uint8_t* keys)
     }
 
     return quit;
-}
\ No newline at end of file
+}
+
+bool Platform::StartAudio(Audio& audio)
+{
+    SDL_AudioSpec want{};
+    want.freq = audio.sampleRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 512; // About 10 ms per callback at 48 kHz
+    want.callback = &Platform::AudioCallback;
+    want.userdata = &audio;
+
+    // SDL converts from this format if the device wants another one
+    SDL_AudioSpec have{};
+    audioDevice = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if (audioDevice == 0)
+    {
+        return false;
+    }
+
+    SDL_PauseAudioDevice(audioDevice, 0);
+    return true;
+}
+
+void Platform::AudioCallback(void* userdata, Uint8* stream, int length)
+{
+    static_cast<Audio*>(userdata)->Fill(reinterpret_cast<int16_t*>(stream), length / sizeof(int16_t));
+}
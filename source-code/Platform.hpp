@@ -3,6 +3,7 @@
 
 #include <SDL2/SDL.h>
 #include <cstdint>
+#include "Audio.hpp"
 
 class Platform
 {
@@ -15,12 +16,29 @@ public:
 
     void Update(void const* buffer, int pitch);
 
+    // Upload only the rows whose bit is set in rows, then present. Nothing is uploaded or presented when rows is 0
+    void Update(void const* buffer, int pitch, uint64_t rows);
+
+    // Present the texture as it is, without uploading (e.g. when the window needs repainting)
+    void Present();
+
     bool ProcessInput(uint8_t* keys);
 
+    bool RewindHeld() const { return rewindHeld; } // Whether the rewind key (Backspace) is held down
+
+    // Play audio's samples on the default device from SDL's audio thread. Returns false when there is no device to play on
+    bool StartAudio(Audio& audio);
+
 private:
     SDL_Window* window{};
     SDL_Renderer* renderer{};
     SDL_Texture* texture{};    
+    int textureWidth{};
+    int textureHeight{};
+    bool rewindHeld{};
+    SDL_AudioDeviceID audioDevice{}; // 0 while no audio is playing
+
+    static void AudioCallback(void* userdata, Uint8* stream, int length); // Runs on SDL's audio thread, userdata is the Audio
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include "Profiler.hpp"
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <string>
+using namespace std;
+
+const unsigned int MAX_DEPTH = 64; // Calls followed into the folded stacks, runaway recursion stops growing them here
+
+Profiler::Profiler()
+{
+    // Cost of reading the clock twice, taken off every sample so cheap opcodes do not all look alike
+    clockOverhead = ~0ull;
+    for (int i = 0; i < 1000; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        clockOverhead = min(clockOverhead, elapsed);
+    }
+
+    Clear();
+}
+
+void Profiler::Clear()
+{
+    fill(begin(classes), end(classes), Counter());
+    addresses.assign(MEMORY_SIZE, Counter());
+    lastOpcode.assign(MEMORY_SIZE, 0);
+
+    frames.assign(1, Frame{-1, 0, 0});
+    children.clear();
+    current = 0;
+    depth = 0;
+    ignored = 0;
+}
+
+void Profiler::Cycle(Chip8& chip8)
+{
+    chip8.Fetch();
+    uint16_t address = chip8.pc;
+    uint16_t opcode = chip8.opcode; // Copied, a memory write may clear the cache entry op points at
+
+    chip8.pc+=2; // Incrementing Program Counter
+
+    auto start = chrono::steady_clock::now();
+    chip8.op->handler(chip8);
+    uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    elapsed = elapsed > clockOverhead ? elapsed - clockOverhead : 0;
+
+    Counter& byClass = classes[Classify(opcode)];
+    byClass.count++;
+    byClass.nanoseconds += elapsed;
+    addresses[address].count++;
+    addresses[address].nanoseconds += elapsed;
+    lastOpcode[address] = opcode;
+
+    // The call itself belongs to the caller, everything after it to the callee until its 00EE
+    frames[current].nanoseconds += elapsed;
+    if ((opcode & 0xF000u) == 0x2000u)
+    {
+        if (depth < MAX_DEPTH)
+        {
+            current = Callee(current, opcode & 0x0FFFu);
+            depth++;
+        }
+        else
+        {
+            ignored++;
+        }
+    }
+    else if (opcode == 0x00EE)
+    {
+        if (ignored > 0)
+        {
+            ignored--;
+        }
+        else if (depth > 0)
+        {
+            current = frames[current].parent;
+            depth--;
+        }
+    }
+}
+
+uint32_t Profiler::Callee(uint32_t frame, uint16_t entry)
+{
+    uint64_t key = (static_cast<uint64_t>(frame) << 16) | entry;
+    auto found = children.find(key);
+    if (found != children.end())
+    {
+        return found->second;
+    }
+
+    frames.push_back(Frame{static_cast<int32_t>(frame), entry, 0});
+    children.emplace(key, frames.size() - 1);
+    return frames.size() - 1;
+}
+
+Profiler::Class Profiler::Classify(uint16_t opcode)
+{
+    unsigned int x = opcode & 0x00FFu;
+
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        switch (opcode)
+        {
+        case 0x00E0: return OP_00E0;
+        case 0x00EE: return OP_00EE;
+        case 0x00FB: return OP_00FB;
+        case 0x00FC: return OP_00FC;
+        case 0x00FD: return OP_00FD;
+        case 0x00FE: return OP_00FE;
+        case 0x00FF: return OP_00FF;
+        default: return (opcode & 0xFFF0u) == 0x00C0 ? OP_00Cn : (opcode & 0xFFF0u) == 0x00D0 ? OP_00Dn : OP_0nnn;
+        }
+    case 0x1: return OP_1nnn;
+    case 0x2: return OP_2nnn;
+    case 0x3: return OP_3xkk;
+    case 0x4: return OP_4xkk;
+    case 0x5: return (opcode & 0xFu) == 2 ? OP_5xy2 : (opcode & 0xFu) == 3 ? OP_5xy3 : OP_5xy0; // Dispatch ignores any other last nibble
+    case 0x6: return OP_6xkk;
+    case 0x7: return OP_7xkk;
+    case 0x8:
+        switch (opcode & 0xFu)
+        {
+        case 0x0: return OP_8xy0;
+        case 0x1: return OP_8xy1;
+        case 0x2: return OP_8xy2;
+        case 0x3: return OP_8xy3;
+        case 0x4: return OP_8xy4;
+        case 0x5: return OP_8xy5;
+        case 0x6: return OP_8xy6;
+        case 0x7: return OP_8xy7;
+        case 0xE: return OP_8xyE;
+        default: return OP_UNKNOWN;
+        }
+    case 0x9: return OP_9xy0; // Whatever the last nibble, like dispatch
+    case 0xA: return OP_Annn;
+    case 0xB: return OP_Bnnn;
+    case 0xC: return OP_Cxkk;
+    case 0xD: return OP_Dxyn;
+    case 0xE: return x == 0x9E ? OP_Ex9E : x == 0xA1 ? OP_ExA1 : OP_UNKNOWN;
+    default:
+        if (opcode == 0xF000 || opcode == 0xF002)
+        {
+            return opcode == 0xF000 ? OP_F000 : OP_F002;
+        }
+        switch (x)
+        {
+        case 0x01: return OP_Fn01;
+        case 0x07: return OP_Fx07;
+        case 0x0A: return OP_Fx0A;
+        case 0x15: return OP_Fx15;
+        case 0x18: return OP_Fx18;
+        case 0x1E: return OP_Fx1E;
+        case 0x29: return OP_Fx29;
+        case 0x30: return OP_Fx30;
+        case 0x33: return OP_Fx33;
+        case 0x3A: return OP_Fx3A;
+        case 0x55: return OP_Fx55;
+        case 0x65: return OP_Fx65;
+        case 0x75: return OP_Fx75;
+        case 0x85: return OP_Fx85;
+        default: return OP_UNKNOWN;
+        }
+    }
+}
+
+const char* Profiler::ClassName(Class opcodeClass)
+{
+    static const char* const names[CLASS_COUNT] = {
+        "00E0", "00EE", "00Cn", "00Dn", "00FB", "00FC", "00FD", "00FE", "00FF", "0nnn",
+        "1nnn", "2nnn", "3xkk", "4xkk", "5xy0", "5xy2", "5xy3", "6xkk", "7xkk",
+        "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "8xyE",
+        "9xy0", "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E", "ExA1",
+        "F000", "Fn01", "F002", "Fx07", "Fx0A", "Fx15", "Fx18", "Fx1E", "Fx29", "Fx30", "Fx33", "Fx3A", "Fx55", "Fx65", "Fx75", "Fx85",
+        "????"};
+    return names[opcodeClass];
+}
+
+void Profiler::Report(ostream& out, size_t hotAddresses) const
+{
+    uint64_t totalCount = 0, totalTime = 0;
+    for (const Counter& counter : classes)
+    {
+        totalCount += counter.count;
+        totalTime += counter.nanoseconds;
+    }
+    double countScale = totalCount ? 100.0 / totalCount : 0.0;
+    double timeScale = totalTime ? 100.0 / totalTime : 0.0;
+
+    vector<unsigned int> order;
+    for (unsigned int c = 0; c < CLASS_COUNT; c++)
+    {
+        if (classes[c].count)
+        {
+            order.push_back(c);
+        }
+    }
+    sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return classes[a].nanoseconds > classes[b].nanoseconds; });
+
+    out << fixed << setprecision(1);
+    out << "opcode       count  count%            ns   time%  ns/exec\n";
+    for (unsigned int c : order)
+    {
+        const Counter& counter = classes[c];
+        out << left << setw(6) << ClassName(static_cast<Class>(c)) << right << setw(12) << counter.count
+            << setw(8) << counter.count * countScale << setw(14) << counter.nanoseconds << setw(8) << counter.nanoseconds * timeScale
+            << setw(9) << static_cast<double>(counter.nanoseconds) / counter.count << "\n";
+    }
+    out << "total " << setw(12) << totalCount << setw(8) << 100.0 << setw(14) << totalTime << setw(8) << 100.0 << "\n\n";
+
+    vector<unsigned int> hot;
+    for (unsigned int a = 0; a < addresses.size(); a++)
+    {
+        if (addresses[a].count)
+        {
+            hot.push_back(a);
+        }
+    }
+    sort(hot.begin(), hot.end(), [&](unsigned int a, unsigned int b) { return addresses[a].nanoseconds > addresses[b].nanoseconds; });
+    hot.resize(min(hot.size(), hotAddresses));
+
+    out << "address  opcode       count  count%            ns   time%\n";
+    for (unsigned int a : hot)
+    {
+        out << hex << uppercase << setfill('0') << "0x" << setw(4) << a << "   " << setw(4) << lastOpcode[a]
+            << dec << nouppercase << setfill(' ') << setw(12) << addresses[a].count << setw(8) << addresses[a].count * countScale
+            << setw(14) << addresses[a].nanoseconds << setw(8) << addresses[a].nanoseconds * timeScale << "\n";
+    }
+    out << defaultfloat;
+}
+
+void Profiler::WriteFolded(ostream& out) const
+{
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        if (frames[f].nanoseconds == 0)
+        {
+            continue;
+        }
+
+        // Walk up to the root, then print outermost first
+        vector<uint16_t> path;
+        for (int32_t at = f; at > 0; at = frames[at].parent)
+        {
+            path.push_back(frames[at].entry);
+        }
+
+        out << "main";
+        for (auto entry = path.rbegin(); entry != path.rend(); ++entry)
+        {
+            out << ";sub_" << hex << uppercase << *entry << dec << nouppercase;
+        }
+        out << " " << frames[f].nanoseconds << "\n";
+    }
+}
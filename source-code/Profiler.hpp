@@ -0,0 +1,66 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <unordered_map>
+#include "Chip8.hpp"
+using namespace std;
+
+// Execution profile of a Chip8 running with engine PROFILE and profiler pointing here.
+// Every instruction is counted and timed (host nanoseconds spent in its handler) per opcode class and per address,
+// and charged to the current CHIP-8 call stack, which follows 2nnn calls and 00EE returns.
+// Runs on the other engines never reach this class and pay nothing for it.
+class Profiler
+{
+public:
+    // Opcode classes the report is broken down by
+    enum Class{
+        OP_00E0, OP_00EE, OP_00Cn, OP_00Dn, OP_00FB, OP_00FC, OP_00FD, OP_00FE, OP_00FF, OP_0nnn,
+        OP_1nnn, OP_2nnn, OP_3xkk, OP_4xkk, OP_5xy0, OP_5xy2, OP_5xy3, OP_6xkk, OP_7xkk,
+        OP_8xy0, OP_8xy1, OP_8xy2, OP_8xy3, OP_8xy4, OP_8xy5, OP_8xy6, OP_8xy7, OP_8xyE,
+        OP_9xy0, OP_Annn, OP_Bnnn, OP_Cxkk, OP_Dxyn, OP_Ex9E, OP_ExA1,
+        OP_F000, OP_Fn01, OP_F002, OP_Fx07, OP_Fx0A, OP_Fx15, OP_Fx18, OP_Fx1E, OP_Fx29, OP_Fx30, OP_Fx33, OP_Fx3A, OP_Fx55, OP_Fx65, OP_Fx75, OP_Fx85,
+        OP_UNKNOWN, CLASS_COUNT
+    };
+
+    struct Counter{
+        uint64_t count{}; // Executions
+        uint64_t nanoseconds{}; // Host time spent executing them
+    };
+
+    Profiler();
+
+    void Cycle(Chip8& chip8); // Execute and record one instruction of chip8, what Chip8::Cycle does unprofiled
+    void Clear();
+
+    void Report(ostream& out, size_t hotAddresses = 20) const; // Classes by time, then the hottest addresses
+    void WriteFolded(ostream& out) const; // "main;sub_2A0;sub_31C <ns>" lines for flamegraph.pl and friends
+
+    static Class Classify(uint16_t opcode); // Class of the handler dispatch runs for opcode
+    static const char* ClassName(Class opcodeClass);
+
+    Counter classes[CLASS_COUNT];
+    vector<Counter> addresses; // By the address the instruction was fetched from, MEMORY_SIZE of them
+    vector<uint16_t> lastOpcode; // Opcode last executed at each address
+
+private:
+    // Distinct call stacks as a tree: a node per call path, its parent being the caller's path
+    struct Frame{
+        int32_t parent; // -1 for the root, the code running outside any subroutine
+        uint16_t entry; // Address called to enter this frame
+        uint64_t nanoseconds; // Time of the instructions executed directly in this frame
+    };
+
+    uint32_t Callee(uint32_t frame, uint16_t entry); // Child of frame for a call to entry, created on first use
+
+    vector<Frame> frames;
+    unordered_map<uint64_t, uint32_t> children; // (frame << 16 | entry) to the child frame
+    uint32_t current{}; // Frame of the instruction executing now
+    uint64_t clockOverhead; // Nanoseconds a sample reads with no work in it
+    unsigned int depth{}; // Calls currently open, calls past a fixed depth are charged to the deepest frame
+    unsigned int ignored{}; // Calls open past that depth, their 00EE must not leave the deepest frame
+};
+
+#endif
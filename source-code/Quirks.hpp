@@ -0,0 +1,53 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <cstring>
+using namespace std;
+
+// CHIP-8 variants that disagree on a handful of instructions
+enum class QuirkProfile{
+    MODERN, // What this emulator always did, and what most ROMs written today expect
+    COSMAC_VIP, // The original interpreter
+    SCHIP, // SUPER-CHIP 1.1
+    XO_CHIP
+};
+
+const unsigned int QUIRK_PROFILES = 4;
+
+// Behaviour of one profile. The interpreter takes it as a compile-time policy (one specialized set of handlers
+// per profile, no flags tested while running), the JIT and the lockstep kernels read it when generating code.
+struct Quirks{
+    bool logicResetsVf; // 8xy1, 8xy2 and 8xy3 clear VF
+    bool shiftReadsVy; // 8xy6 and 8xyE shift Vy into Vx, instead of shifting Vx in place
+    bool loadStoreIncrementsI; // Fx55 and Fx65 leave I pointing past the last register
+    bool jumpUsesVx; // Bnnn jumps to xnn + Vx (BXNN), instead of nnn + V0
+    bool spritesWrap; // Dxyn wraps pixels past the edges around, instead of clipping them
+    bool skipsLongLoad; // Skips step over all 4 bytes of an F000 nnnn, instead of landing on its address word
+};
+
+constexpr Quirks QUIRKS[QUIRK_PROFILES] = {
+    {false, false, false, false, false, false}, // MODERN
+    {true, true, true, false, false, false}, // COSMAC_VIP
+    {false, false, false, true, false, false}, // SCHIP
+    {false, true, true, false, true, true} // XO_CHIP
+};
+
+constexpr const Quirks& QuirksOf(QuirkProfile profile) { return QUIRKS[static_cast<unsigned int>(profile)]; }
+
+// Command line names: modern, vip, schip, xochip
+const char* const QUIRK_PROFILE_NAMES[QUIRK_PROFILES] = {"modern", "vip", "schip", "xochip"};
+
+// Profile called name, throws for an unknown name
+inline QuirkProfile QuirkProfileNamed(const char* name)
+{
+    for (unsigned int p = 0; p < QUIRK_PROFILES; p++)
+    {
+        if (strcmp(name, QUIRK_PROFILE_NAMES[p]) == 0)
+        {
+            return static_cast<QuirkProfile>(p);
+        }
+    }
+    throw "Unknown quirk profile";
+}
+
+#endif
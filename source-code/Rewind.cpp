@@ -0,0 +1,270 @@
+#include "Rewind.hpp"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+const size_t RUN_HEADER = 4; // 16-bit zero run length, then 16-bit literal length
+const size_t MIN_ZERO_RUN = RUN_HEADER + 1; // Shorter runs of zeros are cheaper to keep inside a literal
+const size_t SCHEDULER_BYTES = 2 * sizeof(uint64_t); // Scheduler::cycles and timerTicks, after the Chip8 state
+
+Rewind::Rewind(size_t capacityBytes, size_t maxFrames, unsigned int keyframeInterval)
+: arena(max(capacityBytes, 2 * (Chip8::MAX_STATE_SIZE + SCHEDULER_BYTES))), entries(max<size_t>(maxFrames, 1)),
+  keyframeInterval(max(keyframeInterval, 1u)), state(Chip8::MAX_STATE_SIZE + SCHEDULER_BYTES), keyframe(state.size()), blank(state.size()),
+  encoded(state.size())
+{}
+
+void Rewind::Clear()
+{
+    first = 0;
+    count = 0;
+    head = 0;
+    sinceKeyframe = 0;
+}
+
+size_t Rewind::Bytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        bytes += At(i).length;
+    }
+    return bytes;
+}
+
+size_t Rewind::Encode(const uint8_t* state, const uint8_t* keyframe, size_t size, uint8_t* out) const
+{
+    size_t length = 0;
+    size_t i = 0;
+
+    while (i < size)
+    {
+        // Bytes equal to the keyframe, 8 at a time through the long unchanged stretches of memory
+        size_t zeros = 0;
+        while (i + zeros + 8 <= size && zeros + 8 <= 0xFFFF && memcmp(&state[i + zeros], &keyframe[i + zeros], 8) == 0)
+        {
+            zeros += 8;
+        }
+        while (i + zeros < size && zeros < 0xFFFF && state[i + zeros] == keyframe[i + zeros])
+        {
+            zeros++;
+        }
+        i += zeros;
+
+        if (i == size)
+        {
+            break;
+        }
+
+        // Changed bytes, up to the next run of zeros worth its own header
+        size_t literal = 0;
+        size_t run = 0;
+        while (i + literal + run < size && literal + run < 0xFFFF)
+        {
+            if (state[i + literal + run] == keyframe[i + literal + run])
+            {
+                if (++run == MIN_ZERO_RUN)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                literal += run + 1;
+                run = 0;
+            }
+        }
+
+        // Not smaller than the raw state, the caller stores a keyframe instead
+        if (length + RUN_HEADER + literal >= size)
+        {
+            return size;
+        }
+
+        out[length++] = zeros & 0xFFu;
+        out[length++] = zeros >> 8u;
+        out[length++] = literal & 0xFFu;
+        out[length++] = literal >> 8u;
+        for (size_t j = 0; j < literal; j++)
+        {
+            out[length++] = state[i + j] ^ keyframe[i + j];
+        }
+        i += literal;
+    }
+
+    return length;
+}
+
+void Rewind::Decode(const Entry& entry, const uint8_t* keyframe, uint8_t* state) const
+{
+    const uint8_t* in = &arena[entry.offset];
+
+    if (entry.length == entry.size)
+    {
+        memcpy(state, in, entry.size);
+        return;
+    }
+
+    memcpy(state, entry.keyframe ? blank.data() : keyframe, entry.size);
+
+    const uint8_t* end = in + entry.length;
+    size_t i = 0;
+    while (in < end)
+    {
+        size_t zeros = in[0] | (in[1] << 8u);
+        size_t literal = in[2] | (in[3] << 8u);
+        in += RUN_HEADER;
+
+        i += zeros;
+        for (size_t j = 0; j < literal; j++)
+        {
+            state[i + j] ^= in[j];
+        }
+        i += literal;
+        in += literal;
+    }
+}
+
+void Rewind::DropOldest()
+{
+    // A delta is useless without its keyframe, so the whole group goes
+    do
+    {
+        first = (first + 1) % entries.size();
+        count--;
+    } while (count > 0 && !At(0).keyframe);
+
+    if (count == 0)
+    {
+        Clear();
+    }
+}
+
+size_t Rewind::Allocate(size_t length)
+{
+    while (count > 0)
+    {
+        size_t tail = At(0).offset;
+
+        // Used space is [tail, head) or, once wrapped, [tail, end) plus [0, head); head never catches up with tail
+        if (head >= tail)
+        {
+            if (length <= arena.size() - head)
+            {
+                return head;
+            }
+            if (length < tail)
+            {
+                return 0;
+            }
+        }
+        else if (length < tail - head)
+        {
+            return head;
+        }
+
+        DropOldest();
+    }
+
+    return 0;
+}
+
+size_t Rewind::NewestKeyframe() const
+{
+    size_t i = count - 1;
+    while (!At(i).keyframe)
+    {
+        i--;
+    }
+    return i;
+}
+
+void Rewind::Push(const Chip8& chip8, const Scheduler& scheduler)
+{
+    size_t size = chip8.SaveState(state.data());
+    memcpy(&state[size], &scheduler.cycles, sizeof(uint64_t));
+    memcpy(&state[size + sizeof(uint64_t)], &scheduler.timerTicks, sizeof(uint64_t));
+    size += SCHEDULER_BYTES;
+
+    if (count == entries.size())
+    {
+        DropOldest();
+    }
+
+    // Delta against the newest keyframe, unless a new keyframe is due, the state changed size or the delta would not be smaller
+    size_t length = size;
+    if (count > 0 && sinceKeyframe + 1 < keyframeInterval && size == keyframeSize)
+    {
+        length = Encode(state.data(), keyframe.data(), size, encoded.data());
+    }
+
+    bool isKeyframe = (length == size);
+    if (isKeyframe)
+    {
+        length = Encode(state.data(), blank.data(), size, encoded.data());
+    }
+    size_t offset = Allocate(length);
+
+    // Making room dropped the keyframe the delta was taken against
+    if (!isKeyframe && count == 0)
+    {
+        isKeyframe = true;
+        length = Encode(state.data(), blank.data(), size, encoded.data());
+        offset = Allocate(length);
+    }
+
+    // Encode gives the full size when encoding would not save anything, the state is then stored raw
+    memcpy(&arena[offset], length == size ? state.data() : encoded.data(), length);
+    head = offset + length;
+
+    entries[(first + count) % entries.size()] = Entry{offset, static_cast<uint32_t>(length), static_cast<uint32_t>(size), isKeyframe};
+    count++;
+
+    if (isKeyframe)
+    {
+        memcpy(keyframe.data(), state.data(), size);
+        keyframeSize = size;
+        sinceKeyframe = 0;
+    }
+    else
+    {
+        sinceKeyframe++;
+    }
+}
+
+bool Rewind::Pop(Chip8& chip8, Scheduler& scheduler)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+
+    const Entry newest = At(count - 1);
+    Decode(newest, keyframe.data(), state.data());
+    size_t chip8Size = newest.size - SCHEDULER_BYTES;
+    chip8.LoadState(state.data(), chip8Size);
+    memcpy(&scheduler.cycles, &state[chip8Size], sizeof(uint64_t));
+    memcpy(&scheduler.timerTicks, &state[chip8Size + sizeof(uint64_t)], sizeof(uint64_t));
+
+    // The newest entry was the last one written, its space is free again
+    count--;
+    head = newest.offset;
+
+    if (count == 0)
+    {
+        Clear();
+    }
+    else if (newest.keyframe)
+    {
+        // Back in the previous group: deltas are now taken against its keyframe again
+        size_t key = NewestKeyframe();
+        Decode(At(key), nullptr, keyframe.data());
+        keyframeSize = At(key).size;
+        sinceKeyframe = static_cast<unsigned int>(count - 1 - key);
+    }
+    else
+    {
+        sinceKeyframe--;
+    }
+
+    return true;
+}
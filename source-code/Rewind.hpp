@@ -0,0 +1,60 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Chip8.hpp"
+#include "Scheduler.hpp"
+using namespace std;
+
+// History of Chip8 states, one per frame, for stepping backwards in time. Each entry is the state a frame started from,
+// with the Scheduler's place in emulated time, so popping it undoes exactly that frame.
+// Every keyframeInterval-th entry is a full Chip8::SaveState, run-length encoded against an all-zero state since most
+// of the memory it holds is usually empty; the others store their state XORed against that keyframe and run-length encoded,
+// which leaves a few dozen bytes for a typical frame. A state that changed size starts a new keyframe.
+// All memory is allocated up front: when the arena is full the oldest keyframe and its deltas are dropped.
+class Rewind
+{
+public:
+    // Defaults hold 10 minutes at 60 frames per second within 8 MB
+    Rewind(size_t capacityBytes = 8 * 1024 * 1024, size_t maxFrames = 10 * 60 * 60, unsigned int keyframeInterval = 60);
+
+    void Push(const Chip8& chip8, const Scheduler& scheduler); // Record the state the next frame starts from, just before running it
+    bool Pop(Chip8& chip8, Scheduler& scheduler); // Undo the newest recorded frame by restoring the state it started from, false when there is none
+    void Clear();
+
+    size_t Frames() const { return count; } // States that can be restored
+    size_t Bytes() const; // Arena bytes holding them
+
+private:
+    struct Entry{
+        size_t offset; // Position of the encoded state in arena
+        uint32_t length; // Encoded bytes
+        uint32_t size; // Bytes of the state itself (Chip8 state, then scheduler time), which grows with the memory and screen it holds
+        bool keyframe; // Whole state (raw when length is size, else RLE-coded), otherwise an RLE-coded XOR against the previous keyframe of the same size
+    };
+
+    size_t Encode(const uint8_t* state, const uint8_t* keyframe, size_t size, uint8_t* out) const; // RLE of state ^ keyframe, returns its size
+    void Decode(const Entry& entry, const uint8_t* keyframe, uint8_t* state) const; // keyframe is not read for keyframe entries
+    size_t Allocate(size_t length); // Arena offset for length bytes, dropping the oldest entries to make room
+    void DropOldest(); // Drop the oldest keyframe with all its deltas
+    size_t NewestKeyframe() const; // Index (oldest first) of the keyframe the newest entry belongs to
+    const Entry& At(size_t i) const { return entries[(first + i) % entries.size()]; } // i-th oldest entry
+
+    vector<uint8_t> arena; // Encoded states, written circularly and never split at the end
+    vector<Entry> entries; // Ring of entries in arena order
+    size_t first{}; // Ring position of the oldest entry
+    size_t count{}; // Entries in the ring
+    size_t head{}; // Arena offset the next entry is written at
+    unsigned int keyframeInterval;
+    unsigned int sinceKeyframe{}; // Deltas pushed since the newest keyframe
+
+    vector<uint8_t> state; // Scratch state of up to Chip8::MAX_STATE_SIZE bytes plus the scheduler's cycles and timer ticks
+    vector<uint8_t> keyframe; // Raw state of the newest keyframe, what new deltas are taken against
+    size_t keyframeSize{}; // Bytes of it
+    vector<uint8_t> blank; // All-zero state, what keyframes are encoded against
+    vector<uint8_t> encoded; // Scratch RLE output, never longer than a raw state
+};
+
+#endif
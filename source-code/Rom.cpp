@@ -0,0 +1,168 @@
+#include "Rom.hpp"
+#include "Chip8.hpp"
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+const size_t Rom::MAX_SIZE = MEMORY_SIZE - 0x200; // Programs are loaded at 0x200
+
+mutex RomCache::lock;
+unordered_map<string, RomCache::Entry> RomCache::byPath;
+unordered_map<uint64_t, weak_ptr<const Rom>> RomCache::byHash;
+
+Rom::Rom(const char* filename)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw "Could not open the ROM";
+    }
+
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length))
+    {
+        CloseHandle(file);
+        throw "Could not open the ROM";
+    }
+    if (static_cast<unsigned long long>(length.QuadPart) > MAX_SIZE)
+    {
+        CloseHandle(file);
+        throw "The ROM is too big to fit in memory";
+    }
+    size_t size = static_cast<size_t>(length.QuadPart);
+
+    // An empty file cannot be mapped, and needs no mapping
+    const uint8_t* data = nullptr;
+    if (size > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr)
+        {
+            data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size));
+            CloseHandle(mapping); // The view keeps the mapping alive
+        }
+    }
+    CloseHandle(file);
+    if (data != nullptr)
+    {
+        bytes.assign(data, data + size);
+        UnmapViewOfFile(data);
+    }
+#else
+    int file = open(filename, O_RDONLY);
+    if (file < 0)
+    {
+        throw "Could not open the ROM";
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0)
+    {
+        close(file);
+        throw "Could not open the ROM";
+    }
+    if (static_cast<unsigned long long>(info.st_size) > MAX_SIZE)
+    {
+        close(file);
+        throw "The ROM is too big to fit in memory";
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+    close(file); // The mapping keeps the file alive
+    if (mapped != MAP_FAILED)
+    {
+        bytes.assign(static_cast<const uint8_t*>(mapped), static_cast<const uint8_t*>(mapped) + size);
+        munmap(mapped, size);
+    }
+#endif
+
+    if (bytes.size() != size)
+    {
+        throw "Could not map the ROM";
+    }
+
+    hash = 0xCBF29CE484222325ull;
+    for (uint8_t byte : bytes)
+    {
+        hash ^= byte;
+        hash *= 0x100000001B3ull;
+    }
+}
+
+RomCache::Entry RomCache::Describe(const struct stat& info, shared_ptr<const Rom> rom)
+{
+    Entry entry{move(rom), static_cast<size_t>(info.st_size), static_cast<uint64_t>(info.st_dev), static_cast<uint64_t>(info.st_ino), info.st_mtime, 0, false};
+#if defined(__APPLE__)
+    entry.modifiedNanoseconds = info.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+    entry.modifiedNanoseconds = info.st_mtim.tv_nsec;
+#endif
+    entry.racy = info.st_mtime >= time(nullptr) - 1;
+    return entry;
+}
+
+bool RomCache::Unchanged(const Entry& entry, const struct stat& info)
+{
+    Entry now = Describe(info, nullptr);
+    return entry.size == now.size && entry.device == now.device && entry.inode == now.inode &&
+           entry.modified == now.modified && entry.modifiedNanoseconds == now.modifiedNanoseconds;
+}
+
+shared_ptr<const Rom> RomCache::Get(const char* filename)
+{
+    struct stat info;
+    if (stat(filename, &info) != 0)
+    {
+        return nullptr;
+    }
+
+    lock_guard<mutex> guard(lock);
+
+    auto cached = byPath.find(filename);
+    if (cached != byPath.end() && Unchanged(cached->second, info) && !cached->second.racy)
+    {
+        return cached->second.rom;
+    }
+
+    // New, rewritten or possibly rewritten file; if the cached image or another path already holds the same bytes, share that image instead
+    shared_ptr<const Rom> rom = make_shared<const Rom>(filename);
+    if (cached != byPath.end() && Unchanged(cached->second, info))
+    {
+        const Rom& old = *cached->second.rom;
+        if (old.Size() == rom->Size() && (rom->Size() == 0 || memcmp(old.Data(), rom->Data(), rom->Size()) == 0))
+        {
+            cached->second = Describe(info, cached->second.rom);
+            return cached->second.rom;
+        }
+    }
+    shared_ptr<const Rom> same = byHash[rom->Hash()].lock();
+    if (same && same->Size() == rom->Size() && (rom->Size() == 0 || memcmp(same->Data(), rom->Data(), rom->Size()) == 0))
+    {
+        rom = same;
+    }
+    else
+    {
+        byHash[rom->Hash()] = rom;
+    }
+
+    byPath[filename] = Describe(info, rom);
+    return rom;
+}
+
+void RomCache::Clear()
+{
+    lock_guard<mutex> guard(lock);
+    byPath.clear();
+    byHash.clear();
+}
@@ -0,0 +1,63 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// A ROM file read once through a read-only mapping into its own copy, so loading it into a Chip8 is one memcpy and
+// a file truncated or rewritten on disk later cannot take pages away from under the machines using it.
+// Images are immutable, so any number of machines and threads may share one.
+class Rom
+{
+public:
+    explicit Rom(const char* filename); // Throws if the file cannot be read or does not fit in memory above 0x200
+
+    Rom(const Rom&) = delete;
+    Rom& operator=(const Rom&) = delete;
+
+    const uint8_t* Data() const { return bytes.data(); }
+    size_t Size() const { return bytes.size(); }
+    uint64_t Hash() const { return hash; } // 64-bit FNV-1a hash of the contents, the same as Movie::HashROM
+
+    static const size_t MAX_SIZE; // Largest ROM that fits, MEMORY_SIZE - 0x200 bytes
+
+private:
+    vector<uint8_t> bytes; // Contents of the file when it was read
+    uint64_t hash{};
+};
+
+// Process-wide cache of ROM images. A path is read once and handed out until the file changes on disk,
+// and files with the same contents share one image whatever their path. Safe to call from any thread.
+class RomCache
+{
+public:
+    static shared_ptr<const Rom> Get(const char* filename); // nullptr if the file does not exist, throws like Rom otherwise
+    static void Clear(); // Forget every image; machines still holding one keep it alive
+
+private:
+    struct Entry{
+        shared_ptr<const Rom> rom;
+        size_t size; // File size, identity and modification time when read, a change means the file was rewritten
+        uint64_t device;
+        uint64_t inode;
+        time_t modified;
+        long modifiedNanoseconds; // 0 where the file system or platform does not report them
+        bool racy; // Read within a second of being modified, a rewrite in that second may not show in the fields above
+    };
+
+    static Entry Describe(const struct stat& info, shared_ptr<const Rom> rom);
+    static bool Unchanged(const Entry& entry, const struct stat& info);
+
+    static mutex lock;
+    static unordered_map<string, Entry> byPath;
+    static unordered_map<uint64_t, weak_ptr<const Rom>> byHash; // Weak, an image lives as long as some path or machine uses it
+};
+
+#endif
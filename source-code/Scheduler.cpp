@@ -0,0 +1,47 @@
+#include "Scheduler.hpp"
+#include <algorithm>
+using namespace std;
+
+Scheduler::Scheduler(unsigned int cpuHz, unsigned int timerHz)
+: cpuHz(max(cpuHz, 1u)), timerHz(max(timerHz, 1u))
+{}
+
+uint64_t Scheduler::NextTick() const
+{
+    // Tick k is due once k / timerHz seconds of emulated time have passed, rounded up to a whole instruction
+    return ((timerTicks + 1) * cpuHz + timerHz - 1) / timerHz;
+}
+
+void Scheduler::Run(Chip8& chip8, uint64_t instructions)
+{
+    uint64_t end = cycles + instructions;
+
+    while (true)
+    {
+        // Deliver every tick that is due (several per instruction when cpuHz < timerHz)
+        while (NextTick() <= cycles)
+        {
+            chip8.TickTimers();
+            timerTicks++;
+        }
+
+        if (cycles == end)
+        {
+            break;
+        }
+
+        // Run up to the next tick in one go, the engine never sees a timer change mid-run
+        uint64_t chunk = min(end, NextTick()) - cycles;
+        cycles += chip8.Run(static_cast<unsigned int>(min<uint64_t>(chunk, 0xFFFFFFFFu)));
+    }
+}
+
+void Scheduler::RunFrame(Chip8& chip8)
+{
+    Run(chip8, NextFrameLength());
+}
+
+uint64_t Scheduler::NextFrameLength() const
+{
+    return NextTick() - cycles;
+}
@@ -0,0 +1,33 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include "Chip8.hpp"
+
+// Drives a Chip8 on emulated time: the CPU runs at cpuHz instructions per second and the
+// delay/sound timers tick at timerHz, both counted in executed instructions rather than wall time.
+// The same instruction count therefore always produces the same timer ticks, however fast the host is.
+class Scheduler
+{
+public:
+    Scheduler(unsigned int cpuHz = 700, unsigned int timerHz = 60);
+
+    // Execute the given number of instructions, ticking the timers wherever they fall
+    void Run(Chip8& chip8, uint64_t instructions);
+
+    // Execute one timer period: every instruction up to and including the next timer tick
+    void RunFrame(Chip8& chip8);
+
+    // Instructions in the frame RunFrame would execute next (cpuHz / timerHz, spread evenly when it does not divide)
+    uint64_t NextFrameLength() const;
+
+    unsigned int cpuHz; // Emulated instructions per second
+    unsigned int timerHz; // Timer ticks per second
+    uint64_t cycles{}; // Instructions executed so far
+    uint64_t timerTicks{}; // Timer ticks delivered so far
+
+private:
+    uint64_t NextTick() const; // Value of cycles at which the next timer tick is due
+};
+
+#endif
@@ -0,0 +1,806 @@
+#include "Chip8.hpp"
+#include "Scheduler.hpp"
+#include "Lockstep.hpp"
+#include "Rom.hpp"
+#include "Rewind.hpp"
+#include "Movie.hpp"
+#include "Chip8C.h"
+#include "Audio.hpp"
+#include "Env.hpp"
+#include <iostream>
+#include <initializer_list>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <string>
+using namespace std;
+
+// Checks of behaviour the ROMs in the tree do not exercise, run by `make test`
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        cout << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+// A machine with program at 0x200
+static Chip8 Machine(QuirkProfile quirks, initializer_list<uint16_t> program)
+{
+    Chip8 chip8;
+    chip8.SetQuirks(quirks);
+    chip8.Seed(0);
+
+    unsigned int address = 0x200;
+    for (uint16_t opcode : program)
+    {
+        chip8.memory[address++] = opcode >> 8;
+        chip8.memory[address++] = opcode & 0xFFu;
+    }
+    chip8.MemoryWritten(0x200, address - 0x200);
+    return chip8;
+}
+
+// Fx55, Fx65 and Fx33 with I near the top of the 64K XO-CHIP memory wrap around to address 0
+static void TestMemoryWraps()
+{
+    Chip8 chip8 = Machine(QuirkProfile::MODERN, {0xFF55, 0xFF65, 0xF033, 0xF033});
+    for (unsigned int r = 0; r < 16; r++)
+    {
+        chip8.registers[r] = 0x10 + r;
+    }
+
+    // Decode the word at 0 first, the wrapped store must drop it
+    chip8.pc = 0;
+    chip8.Fetch();
+    chip8.pc = 0x200;
+
+    chip8.index = 0xFFF8;
+    chip8.Cycle(); // FF55
+    bool stored = true;
+    for (unsigned int r = 0; r < 16; r++)
+    {
+        stored = stored && chip8.memory[(0xFFF8 + r) & 0xFFFFu] == 0x10 + r;
+    }
+    Check(stored, "Fx55 at I = 0xFFF8 wraps to address 0");
+    Check(chip8.memory[8] == 0 && chip8.memory[0xFFF7] == 0, "Fx55 at I = 0xFFF8 writes only 16 bytes");
+
+    chip8.pc = 0;
+    chip8.Fetch();
+    Check(chip8.opcode == 0x1819, "Fx55 wrapping to address 0 invalidates the code decoded there");
+    chip8.pc = 0x202;
+
+    memset(chip8.registers, 0, sizeof(chip8.registers));
+    chip8.Cycle(); // FF65
+    Check(chip8.registers[0] == 0x10 && chip8.registers[15] == 0x1F, "Fx65 at I = 0xFFF8 wraps to address 0");
+
+    // The same three digits once at 0x300 and once across the top of memory
+    chip8.registers[0] = 123;
+    chip8.index = 0x300;
+    chip8.Cycle(); // F033
+    chip8.index = 0xFFFE;
+    chip8.Cycle(); // F033
+    Check(chip8.memory[0x300] == 1 && chip8.memory[0x301] == 2 && chip8.memory[0x302] == 3, "Fx33 stores the hundreds digit first");
+    Check(chip8.memory[0xFFFE] == 1 && chip8.memory[0xFFFF] == 2 && chip8.memory[0] == 3, "Fx33 at I = 0xFFFE wraps to address 0");
+}
+
+// A lockstep lane whose wrapped store rewrites the code at address 0 runs the new code
+static void TestLockstepWrappedStore()
+{
+    Chip8 start = Machine(QuirkProfile::XO_CHIP, {
+        0xF000, 0xFFF8, // I = 0xFFF8
+        0x6812, 0x690C, // V8, V9 = 12 0C, a jump to 0x20C once stored at address 0
+        0xF955, // Store V0-V9, V8 and V9 land at 0 and 1
+        0x1000, // Jump to 0
+        0x6B77, // 0x20C: VB = 0x77
+        0x120E // 0x20E: stop here
+    });
+
+    Chip8 reference = start;
+    Scheduler scheduler;
+    scheduler.Run(reference, 64);
+
+    Lockstep lockstep(2, start);
+    lockstep.Run(64);
+
+    for (size_t lane = 0; lane < lockstep.Size(); lane++)
+    {
+        Chip8 chip8;
+        lockstep.Store(lane, chip8);
+        Check(chip8.registers[0xB] == 0x77 && chip8.pc == reference.pc && reference.registers[0xB] == 0x77,
+              "Lockstep runs code rewritten by a store wrapping past 0xFFFF");
+    }
+}
+
+// Whether LoadState refuses a state
+static bool Rejects(Chip8& chip8, const vector<uint8_t>& state, size_t size)
+{
+    try
+    {
+        chip8.LoadState(state.data(), size);
+    }
+    catch (const char*)
+    {
+        return true;
+    }
+    return false;
+}
+
+// States hold only the memory and screen in use, and restore exactly what was saved
+static void TestStateSize()
+{
+    Chip8 chip8 = Machine(QuirkProfile::XO_CHIP, {
+        0x6005, 0xF029, 0xD005, // Draw the 5 at the top left
+        0xF000, 0x8000, 0xF033, // Digits of V0 at 0x8000
+        0x1210
+    });
+    Scheduler scheduler;
+    scheduler.Run(chip8, 3);
+
+    vector<uint8_t> compact(Chip8::MAX_STATE_SIZE);
+    compact.resize(chip8.SaveState(compact.data()));
+    Check(compact.size() == chip8.StateSize() && compact.size() < 4608, "A low resolution state is under 4.5 KB");
+
+    scheduler.Run(chip8, 3);
+    vector<uint8_t> extended(Chip8::MAX_STATE_SIZE);
+    extended.resize(chip8.SaveState(extended.data()));
+    Check(extended.size() == compact.size() + 0x7100, "A state holds memory up to the page of the highest store");
+
+    Chip8 loaded;
+    loaded.LoadState(extended.data(), extended.size());
+    vector<uint8_t> again(Chip8::MAX_STATE_SIZE);
+    again.resize(loaded.SaveState(again.data()));
+    Check(again == extended && loaded.memory[0x8000] + loaded.memory[0x8001] + loaded.memory[0x8002] == 5,
+          "Loading a state restores memory past 4K and the screen");
+
+    loaded.LoadState(compact.data(), compact.size());
+    Check(loaded.memory[0x8000] == 0 && loaded.memory[0x8001] == 0 && loaded.memory[0x8002] == 0 && loaded.StateSize() == compact.size(),
+          "Loading a smaller state clears the memory it does not hold");
+
+    Check(Rejects(loaded, compact, compact.size() - 1), "A truncated state is rejected");
+
+    // Stack pointer and selected planes, the bytes after memory, index, pc and the stack, then after timers, keypad and resolution
+    size_t sp = 4 + 1 + 16 + 1 + 0x1000 + 2 + 2 + 16 * 2;
+    size_t planes = sp + 1 + 2 + 2 + 1;
+    for (size_t at : {sp, planes})
+    {
+        vector<uint8_t> corrupt = compact;
+        corrupt[at] = at == sp ? 17 : 4;
+        Check(Rejects(loaded, corrupt, corrupt.size()) && loaded.sp == compact[sp] && loaded.planes == compact[planes], "A state with sp past 16 or unknown planes is rejected untouched");
+    }
+}
+
+// Reset puts back the code and the high memory a program overwrote, exactly as a new machine has them
+static void TestResetRestoresMemory()
+{
+    Chip8 chip8 = Machine(QuirkProfile::XO_CHIP, {
+        0x6077, 0xF000, 0xF000, // V0 = 0x77, I = 0xF000
+        0x61FF, // 0x206: V1 = 0xFF
+        0xF055, // Store V0, reaching the code at 0x200 once I wraps
+        0xF11E, // I += 0xFF
+        0x1206
+    });
+    Scheduler scheduler;
+    scheduler.Run(chip8, 2000);
+    Check(chip8.memoryTop > 0xF000 && chip8.memory[0x200] == 0x77, "The program stores high in memory and over its own code");
+    chip8.Reset();
+
+    Chip8 fresh;
+    chip8.Seed(1);
+    fresh.Seed(1);
+    vector<uint8_t> reset(Chip8::MAX_STATE_SIZE), expected(Chip8::MAX_STATE_SIZE);
+    reset.resize(chip8.SaveState(reset.data()));
+    expected.resize(fresh.SaveState(expected.data()));
+    chip8.Fetch();
+    Check(reset == expected && memcmp(chip8.memory, fresh.memory, MEMORY_SIZE) == 0 && chip8.opcode == 0,
+          "Reset restores every byte written, above 4K and over the code");
+}
+
+// A cached ROM keeps its bytes when the file is truncated behind its back
+static void TestRomOutlivesItsFile()
+{
+    const char* path = "tests_truncated.ch8";
+    ofstream(path, ios::binary) << "\x12\x34";
+    shared_ptr<const Rom> rom = RomCache::Get(path);
+    ofstream(path, ios::binary | ios::trunc).close();
+
+    Chip8 chip8;
+    chip8.LoadROM(rom);
+    chip8.Reset();
+    Check(rom->Size() == 2 && chip8.memory[0x200] == 0x12 && chip8.memory[0x201] == 0x34, "A ROM truncated on disk still loads and resets");
+    remove(path);
+}
+
+// A ROM rewritten with the same size in the same second as it was read is read again
+static void TestRomRewrittenInPlace()
+{
+    const char* path = "tests_rewritten.ch8";
+    ofstream(path, ios::binary) << "\x12\x34";
+    shared_ptr<const Rom> before = RomCache::Get(path);
+    ofstream(path, ios::binary | ios::trunc) << "\x56\x78";
+    shared_ptr<const Rom> after = RomCache::Get(path);
+    remove(path);
+
+    Check(before->Data()[0] == 0x12 && after->Size() == 2 && after->Data()[0] == 0x56 && after->Data()[1] == 0x78, "A ROM rewritten in place is not served from the cache");
+}
+
+// Dxyn marks exactly the rendered rows its sprite touched, clears and scrolls mark them all
+static void TestDirtyRows()
+{
+    Chip8 lores = Machine(QuirkProfile::MODERN, {
+        0xA20C, 0x6000, 0x610A, // I = sprite, V0 = 0, V1 = 10
+        0xD013, // Rows 10 and 12, the empty row 11 changes nothing
+        0x611E, 0xD013, // Rows 30 and 31, row 32 is clipped
+        0xF000, 0xF000 // 0x20C: F0 00 F0 00
+    });
+    lores.Cycle(); lores.Cycle(); lores.Cycle();
+    lores.dirtyRows = 0;
+    lores.Cycle(); // D013
+    Check(lores.dirtyRows == ((3ull << 20) | (3ull << 24)), "Low resolution Dxyn marks two rendered rows per sprite row it changed");
+    lores.Cycle();
+    lores.dirtyRows = 0;
+    lores.Cycle(); // D013 at the bottom
+    Check(lores.dirtyRows == 3ull << 60, "Low resolution Dxyn does not mark clipped rows");
+
+    Chip8 hires = Machine(QuirkProfile::SCHIP, {
+        0x00FF, 0xA20E, 0x6000, 0x613E, // High resolution, I = sprite, V0 = 0, V1 = 62
+        0xD013, // Rows 62 and 63 only
+        0x00E0, 0x00C1, // Clear, scroll down
+        0xF0F0, 0xF000 // 0x20E: F0 F0 F0 00
+    });
+    hires.Cycle(); hires.Cycle(); hires.Cycle(); hires.Cycle();
+    hires.dirtyRows = 0;
+    hires.Cycle(); // D013
+    Check(hires.dirtyRows == 3ull << 62, "High resolution Dxyn marks one rendered row per sprite row, clipped rows excluded");
+    hires.dirtyRows = 0;
+    hires.Cycle(); // 00E0
+    Check(hires.dirtyRows == ~0ull, "00E0 marks every row");
+    hires.dirtyRows = 0;
+    hires.Cycle(); // 00C1
+    Check(hires.dirtyRows == ~0ull, "00Cn marks every row");
+}
+
+// The audio ring hands samples back in order across many wraps of its positions, and never over-fills
+static void TestAudioRingWraps()
+{
+    AudioRing ring(5);
+    Check(ring.Capacity() == 8, "AudioRing rounds its capacity up to a power of two");
+
+    int16_t next = 0, expected = 0;
+    bool ordered = true, bounded = true;
+    for (int round = 0; round < 100; round++)
+    {
+        // Uneven batch sizes so the positions land on every offset of the buffer
+        int16_t in[8], out[8];
+        size_t count = 1 + round % 7;
+        for (size_t i = 0; i < count; i++)
+        {
+            in[i] = next + i;
+        }
+        size_t queued = ring.Size();
+        size_t written = ring.Write(in, count);
+        bounded = bounded && written == min(count, 8 - queued) && ring.Size() == queued + written;
+        next += written;
+
+        size_t read = ring.Read(out, 1 + round % 5);
+        for (size_t i = 0; i < read; i++)
+        {
+            ordered = ordered && out[i] == expected++;
+        }
+    }
+    int16_t out[8];
+    size_t read = ring.Read(out, 8);
+    for (size_t i = 0; i < read; i++)
+    {
+        ordered = ordered && out[i] == expected++;
+    }
+
+    Check(bounded, "AudioRing::Write queues only what fits");
+    Check(ordered && expected == next && ring.Size() == 0, "AudioRing reads back every sample written, in order, across wraps");
+}
+
+// SCHIP and XO-CHIP display instructions: scrolls of the selected planes only, resolution switches, 16 x 16 sprites
+static void TestSuperChipScreen()
+{
+    const uint64_t pattern = 0x8000000000000001ull;
+
+    Chip8 chip8 = Machine(QuirkProfile::XO_CHIP, {0x00FF, 0xF201, 0x00C2, 0x00D2, 0x00FB, 0x00FC, 0xF301, 0x00FB, 0xF201, 0x00FE});
+    chip8.Cycle(); chip8.Cycle(); // High resolution, plane 1 only
+    for (unsigned int plane = 0; plane < PLANES; plane++)
+    {
+        chip8.screen[10][plane][0] = pattern;
+        chip8.screen[10][plane][1] = 1;
+    }
+
+    chip8.Cycle(); // 00C2
+    Check(chip8.screen[12][1][0] == pattern && chip8.screen[12][1][1] == 1 && chip8.screen[10][1][0] == 0 && chip8.screen[10][0][0] == pattern && chip8.screen[12][0][0] == 0,
+          "00Cn scrolls only the selected planes down");
+    chip8.Cycle(); // 00D2
+    Check(chip8.screen[10][1][0] == pattern && chip8.screen[10][1][1] == 1 && chip8.screen[12][1][0] == 0 && chip8.screen[10][0][0] == pattern,
+          "00Dn scrolls only the selected planes up");
+    chip8.Cycle(); // 00FB
+    Check(chip8.screen[10][1][0] == 0x0800000000000000ull && chip8.screen[10][1][1] == 0x1000000000000000ull && chip8.screen[10][0][0] == pattern && chip8.screen[10][0][1] == 1,
+          "00FB scrolls only the selected planes right, across the two words of a row");
+    chip8.Cycle(); // 00FC
+    Check(chip8.screen[10][1][0] == pattern && chip8.screen[10][1][1] == 0 && chip8.screen[10][0][0] == pattern && chip8.screen[10][0][1] == 1,
+          "00FC scrolls only the selected planes left, across the two words of a row");
+    chip8.Cycle(); chip8.Cycle(); // Both planes, 00FB
+    Check(chip8.screen[10][0][0] == 0x0800000000000000ull && chip8.screen[10][1][0] == 0x0800000000000000ull, "00FB scrolls every selected plane");
+
+    chip8.Cycle(); chip8.Cycle(); // Plane 1 only, 00FE
+    bool blank = true;
+    for (auto& line : chip8.screen)
+    {
+        blank = blank && line[0][0] == 0 && line[0][1] == 0 && line[1][0] == 0 && line[1][1] == 0;
+    }
+    Check(!chip8.hires && blank, "00FE switches to low resolution and clears every plane, selected or not");
+
+    // 16 x 16 sprite of solid rows at 0x300
+    Chip8 hires = Machine(QuirkProfile::SCHIP, {0x00FF, 0xA300, 0x6008, 0x6104, 0xD010, 0xD010});
+    memset(&hires.memory[0x300], 0xFF, 32);
+    hires.MemoryWritten(0x300, 32);
+    for (int i = 0; i < 5; i++)
+    {
+        hires.Cycle();
+    }
+    Check(hires.hires, "00FF switches to high resolution");
+    bool drawn = hires.screen[3][0][0] == 0 && hires.screen[20][0][0] == 0 && hires.registers[0xF] == 0;
+    for (unsigned int y = 4; y < 20; y++)
+    {
+        drawn = drawn && hires.screen[y][0][0] == 0xFFFFull << 40 && hires.screen[y][0][1] == 0;
+    }
+    Check(drawn, "Dxy0 draws 16 x 16 in high resolution");
+    hires.Cycle();
+    Check(hires.registers[0xF] == 1 && hires.screen[4][0][0] == 0 && hires.screen[19][0][0] == 0, "Dxy0 collides and erases in high resolution");
+
+    Chip8 lores = Machine(QuirkProfile::SCHIP, {0xA300, 0x6038, 0x6114, 0xD010}); // At (56, 20), clipped right and below
+    memset(&lores.memory[0x300], 0xFF, 32);
+    lores.MemoryWritten(0x300, 32);
+    for (int i = 0; i < 4; i++)
+    {
+        lores.Cycle();
+    }
+    drawn = lores.screen[19][0][0] == 0 && lores.screen[0][0][0] == 0;
+    for (unsigned int y = 20; y < 32; y++)
+    {
+        drawn = drawn && lores.screen[y][0][0] == 0xFFull && lores.screen[y][0][1] == 0;
+    }
+    Check(drawn, "Dxy0 draws 16 x 16 in low resolution, clipped at the edges");
+}
+
+// Fx30 points at the big digits, Fx75 and Fx85 keep registers in the RPL flags
+static void TestSuperChipRegisters()
+{
+    Chip8 chip8 = Machine(QuirkProfile::SCHIP, {0x6307, 0xF330, 0xF775, 0xF385});
+    chip8.Cycle(); chip8.Cycle();
+    Check(chip8.index == 0xA0 + 7 * 10 && chip8.memory[chip8.index] != 0, "Fx30 points I at the 10-byte sprite of digit Vx");
+
+    for (unsigned int r = 0; r < 8; r++)
+    {
+        chip8.registers[r] = 0x40 + r;
+    }
+    chip8.Cycle(); // F775
+    memset(chip8.registers, 0, sizeof(chip8.registers));
+    chip8.Cycle(); // F385
+    bool restored = chip8.rplFlags[7] == 0x47 && chip8.rplFlags[8] == 0;
+    for (unsigned int r = 0; r < 8; r++)
+    {
+        restored = restored && chip8.registers[r] == (r <= 3 ? 0x40 + r : 0);
+    }
+    Check(restored, "Fx75 stores V0-Vx in the RPL flags and Fx85 reads back only V0-Vx");
+}
+
+// Machine that runs body 40 times from 0x202 with engine, enough for the JIT to compile it, then stops in place.
+// body may use every register but VE, the loop counter
+static Chip8 Looped(QuirkProfile quirks, Chip8::Engine engine, initializer_list<uint16_t> body)
+{
+    Chip8 chip8 = Machine(quirks, {0x6E00});
+
+    unsigned int address = 0x202;
+    uint16_t tail = 0x202 + 2 * body.size();
+    for (uint16_t opcode : body)
+    {
+        chip8.memory[address++] = opcode >> 8;
+        chip8.memory[address++] = opcode & 0xFFu;
+    }
+    for (uint16_t opcode : {uint16_t(0x7E01), uint16_t(0x3E28), uint16_t(0x1202), uint16_t(0x1000 | (tail + 6))})
+    {
+        chip8.memory[address++] = opcode >> 8;
+        chip8.memory[address++] = opcode & 0xFFu;
+    }
+    chip8.MemoryWritten(0x202, address - 0x202);
+
+    // Bnnn lands here: VA = 1 at nnn + V0, VA = 2 at nnn + V3
+    const uint8_t targets[] = {0x6A, 0x01, uint8_t(0x10 | tail >> 8), uint8_t(tail), 0x6A, 0x02, uint8_t(0x10 | tail >> 8), uint8_t(tail)};
+    memcpy(&chip8.memory[0x314], targets, 4);
+    memcpy(&chip8.memory[0x318], targets + 4, 4);
+    chip8.MemoryWritten(0x314, 8);
+
+    // Sprite for the edge draws
+    chip8.memory[0x3F0] = 0xFF;
+    chip8.memory[0x3F1] = 0xFF;
+    chip8.MemoryWritten(0x3F0, 2);
+
+    chip8.engine = engine;
+    chip8.pc = 0x200;
+    chip8.Run(100000);
+    return chip8;
+}
+
+// Every quirk flag does what its profile says, under every engine
+static void TestQuirks()
+{
+    const QuirkProfile profiles[] = {QuirkProfile::MODERN, QuirkProfile::COSMAC_VIP, QuirkProfile::SCHIP, QuirkProfile::XO_CHIP};
+    const Chip8::Engine engines[] = {Chip8::Engine::INTERPRETER, Chip8::Engine::JIT};
+
+    for (QuirkProfile profile : profiles)
+    {
+        const Quirks& quirks = QuirksOf(profile);
+        bool shiftRight = true, shiftLeft = true, store = true, load = true, jump = true, edges = true, logic = true, skip = true;
+
+        for (Chip8::Engine engine : engines)
+        {
+            Chip8 chip8 = Looped(profile, engine, {0x6010, 0x6103, 0x8016}); // V0 = 0x10, V1 = 3, shift right
+            shiftRight = shiftRight && chip8.registers[0] == (quirks.shiftReadsVy ? 0x01 : 0x08) && chip8.registers[0xF] == (quirks.shiftReadsVy ? 1 : 0);
+
+            chip8 = Looped(profile, engine, {0x6010, 0x6181, 0x801E}); // V0 = 0x10, V1 = 0x81, shift left
+            shiftLeft = shiftLeft && chip8.registers[0] == (quirks.shiftReadsVy ? 0x02 : 0x20) && chip8.registers[0xF] == (quirks.shiftReadsVy ? 1 : 0);
+
+            chip8 = Looped(profile, engine, {0xA300, 0xF255});
+            store = store && chip8.index == (quirks.loadStoreIncrementsI ? 0x303 : 0x300);
+
+            chip8 = Looped(profile, engine, {0xA300, 0xF265});
+            load = load && chip8.index == (quirks.loadStoreIncrementsI ? 0x303 : 0x300);
+
+            chip8 = Looped(profile, engine, {0x6004, 0x6308, 0xB310}); // nnn + V0 = 0x314, xnn + V3 = 0x318
+            jump = jump && chip8.registers[0xA] == (quirks.jumpUsesVx ? 2 : 1);
+
+            // An 8 x 2 sprite at (60, 31) of the low resolution screen
+            chip8 = Looped(profile, engine, {0x00E0, 0xA3F0, 0x603C, 0x611F, 0xD012});
+            const uint64_t wrapped = 0xF00000000000000Full;
+            edges = edges && chip8.screen[31][0][0] == (quirks.spritesWrap ? wrapped : 0xFull) && chip8.screen[0][0][0] == (quirks.spritesWrap ? wrapped : 0);
+
+            // VF = 5 before each of OR, AND and XOR, copied to V2 and V3 after the first two
+            chip8 = Looped(profile, engine, {0x600F, 0x61F0, 0x6F05, 0x8011, 0x82F0, 0x6F05, 0x8012, 0x83F0, 0x6F05, 0x8013});
+            uint8_t vf = quirks.logicResetsVf ? 0 : 5;
+            logic = logic && chip8.registers[2] == vf && chip8.registers[3] == vf && chip8.registers[0xF] == vf;
+
+            // A taken skip over F000 nnnn lands on its address word, 6A07, unless it skips all 4 bytes
+            chip8 = Looped(profile, engine, {0x6A00, 0x6000, 0x3000, 0xF000, 0x6A07, 0x6B01});
+            skip = skip && chip8.registers[0xA] == (quirks.skipsLongLoad ? 0 : 7) && chip8.registers[0xB] == 1;
+        }
+
+        const char* name = QUIRK_PROFILE_NAMES[static_cast<unsigned int>(profile)];
+        auto CheckQuirk = [name](bool condition, const char* what)
+        {
+            if (!condition)
+            {
+                cout << "[" << name << "] ";
+            }
+            Check(condition, what);
+        };
+        CheckQuirk(shiftRight, "8xy6 shifts the register its profile says");
+        CheckQuirk(shiftLeft, "8xyE shifts the register its profile says");
+        CheckQuirk(store, "Fx55 moves I as its profile says");
+        CheckQuirk(load, "Fx65 moves I as its profile says");
+        CheckQuirk(jump, "Bnnn adds the register its profile says");
+        CheckQuirk(edges, "Dxyn clips or wraps as its profile says");
+        CheckQuirk(logic, "8xy1, 8xy2 and 8xy3 reset VF as their profile says");
+        CheckQuirk(skip, "Skips over F000 nnnn step as far as their profile says");
+    }
+}
+
+// Compiled loops survive stores next to them and see stores into them, and the JIT never leaves its code writable
+// and executable at once
+static void TestJitCode()
+{
+    // 40 times round a loop storing V0 to 0x20E, the word right after it
+    Chip8 chip8 = Machine(QuirkProfile::MODERN, {0x6E00, 0x7E01, 0xA20E, 0xF055, 0x3E28, 0x1202, 0x120C});
+    chip8.engine = Chip8::Engine::JIT;
+    chip8.Run(200);
+    const Chip8::Block& loop = chip8.blocks[chip8.blockAt[0x202 >> 1]];
+    Check(chip8.registers[0xE] == 40 && loop.native != nullptr && loop.jitGeneration == chip8.jit.generation,
+          "A loop storing data next to its code still gets compiled");
+
+    // Once VE reaches 32 the loop stores V0 = 7E over the 7D of the subroutine at 0x240, which then counts VE instead of VD
+    Chip8 patched = Machine(QuirkProfile::MODERN, {0x6E00, 0x607E, 0xA220, 0x6320, 0x82E0, 0x8232, 0xF21E, 0xF055, 0x2240, 0x7E01, 0x3E28, 0x1204, 0x1218});
+    patched.memory[0x240] = 0x7D; // VD += 1, return
+    patched.memory[0x241] = 0x01;
+    patched.memory[0x242] = 0x00;
+    patched.memory[0x243] = 0xEE;
+    patched.MemoryWritten(0x240, 4);
+    patched.engine = Chip8::Engine::JIT;
+    patched.Run(2000);
+    Check(patched.registers[0xD] == 32 && patched.registers[0xE] == 40 && patched.pc == 0x218,
+          "A compiled loop runs the instruction it stored over compiled code");
+
+#ifdef __linux__
+    bool writableCode = false;
+    ifstream maps("/proc/self/maps");
+    string line;
+    while (getline(maps, line))
+    {
+        size_t permissions = line.find(' ') + 1;
+        writableCode = writableCode || (line[permissions + 1] == 'w' && line[permissions + 2] == 'x');
+    }
+    Check(!writableCode, "No memory is writable and executable at once");
+#endif
+}
+
+// Write program as a ROM file
+static void WriteRom(const char* path, initializer_list<uint16_t> program)
+{
+    ofstream file(path, ios::binary);
+    for (uint16_t opcode : program)
+    {
+        file.put(static_cast<char>(opcode >> 8));
+        file.put(static_cast<char>(opcode & 0xFFu));
+    }
+}
+
+// Counts frames in V0 and stores them as BCD digits at 0x300, one loop of 4 instructions per frame at 240 Hz
+static Env::Config CounterConfig()
+{
+    Env::Config config;
+    config.cpuHz = 240;
+    config.stickyActions = 0;
+    config.reward.push_back(Env::RamValue{0x300, 3, true, 1});
+    return config;
+}
+
+// Frame skip, rewards read from BCD digits, the end of an episode, truncation and the high resolution observation
+static void TestEnv()
+{
+    const char* counter = "tests_counter.ch8";
+    WriteRom(counter, {0x7001, 0xA300, 0xF033, 0x1200});
+
+    Env::Config config = CounterConfig();
+    config.done.push_back(Env::RamCondition{Env::RamValue{0x300, 3, true, 1}, 10});
+    Env env(counter, config);
+
+    Env::StepResult first = env.Step(0);
+    Env::StepResult second = env.Step(0);
+    Check(first.reward == 4 && second.reward == 4 && env.Frames() == 8 && !second.done && !second.truncated,
+          "Env::Step runs frameSkip frames and rewards the change of a BCD score");
+    Env::StepResult last = env.Step(0);
+    Check(last.done && !last.truncated && last.reward == 2 && env.Frames() == 10, "Env::Step stops at the frame a done condition is met");
+    env.Reset();
+    Check(env.Frames() == 0 && env.Step(0).reward == 4, "Env::Reset starts the score over");
+
+    config = CounterConfig();
+    config.maxFrames = 6;
+    Env truncated(counter, config);
+    truncated.Step(0);
+    last = truncated.Step(0);
+    Check(last.truncated && !last.done && last.reward == 2 && truncated.Frames() == 6, "Env::Step truncates the episode after maxFrames");
+
+    // Sticky actions: action 1 holds key 0 and action 2 key 1, alternated one frame per step
+    config = CounterConfig();
+    config.frameSkip = 1;
+    config.stickyActions = 0.5f;
+    config.seed = 7;
+    Env sticky(counter, config), same(counter, config);
+    unsigned int stuck = 0;
+    bool repeatable = true;
+    for (unsigned int step = 0; step < 200; step++)
+    {
+        unsigned int action = 1 + step % 2;
+        sticky.Step(action);
+        same.Step(action);
+        stuck += !sticky.chip8.keypad[action - 1];
+        repeatable = repeatable && memcmp(sticky.chip8.keypad, same.chip8.keypad, sizeof(sticky.chip8.keypad)) == 0;
+    }
+    Check(repeatable, "Sticky actions repeat exactly with the same seed");
+    Check(stuck > 60 && stuck < 140, "Sticky actions keep the previous keys about as often as asked");
+
+    config.stickyActions = 1;
+    Env stuckForever(counter, config);
+    stuckForever.Step(1);
+    Check(stuckForever.chip8.keypad[0] == 0, "Sticky actions of 1 never let the action through");
+    remove(counter);
+
+    // Pixels at (2, 3) and (127, 63) of the high resolution screen, then a jump to itself
+    const char* hires = "tests_hires.ch8";
+    WriteRom(hires, {0x00FF, 0xA212, 0x6002, 0x6103, 0xD011, 0x607F, 0x613F, 0xD011, 0x1210, 0x8000});
+    config = CounterConfig();
+    config.cpuHz = 700;
+    config.reward.clear();
+    Env screen(hires, config);
+    remove(hires);
+    last = screen.Step(0);
+    bool observed = true;
+    for (unsigned int y = 0; y < Env::OBSERVATION_WORDS; y++)
+    {
+        observed = observed && screen.Observation()[y] == (y == 1 ? 1ull << 62 : y == 31 ? 1ull : 0);
+    }
+    Check(observed, "Env observes high resolution halved, a pixel set when any of its 2 x 2 is");
+    Check(last.done, "Env ends the episode when the program jumps to itself");
+}
+
+// VecEnv starts a finished environment over within the step that ended it
+static void TestVecEnvAutoReset()
+{
+    const char* counter = "tests_counter.ch8";
+    WriteRom(counter, {0x7001, 0xA300, 0xF033, 0x1200});
+
+    Env::Config config = CounterConfig();
+    config.done.push_back(Env::RamCondition{Env::RamValue{0x300, 3, true, 1}, 10});
+    ThreadPool pool(2);
+    VecEnv envs(pool, 2, counter, config);
+    remove(counter);
+
+    const unsigned int actions[2] = {0, 0};
+    envs.Step(actions);
+    envs.Step(actions);
+    envs.Step(actions);
+    Check(envs.Dones()[0] == 1 && envs.Dones()[1] == 1 && envs.Rewards()[0] == 2 && !envs.Truncations()[0], "VecEnv reports the step that ended an episode");
+    Check(envs[0].Frames() == 0 && envs[1].Frames() == 0, "VecEnv resets an environment in the step that ended its episode");
+    envs.Step(actions);
+    Check(envs.Dones()[0] == 0 && envs.Rewards()[0] == 4 && envs[0].Frames() == 4, "VecEnv steps the new episode from its start");
+}
+
+// Everything SaveState records about a machine
+static vector<uint8_t> State(const Chip8& chip8)
+{
+    vector<uint8_t> state(Chip8::MAX_STATE_SIZE);
+    state.resize(chip8.SaveState(state.data()));
+    return state;
+}
+
+// Popping k of N pushed frames lands on the machine and emulated time right after frame N - k
+static void TestRewind()
+{
+    Chip8 chip8 = Machine(QuirkProfile::MODERN, {
+        0xC0FF, 0x7101, // Random V0, V1 counts instructions
+        0xF015, 0xA300, 0xF033, // Delay timer from V0, digits of V0 at 0x300
+        0x1200
+    });
+    Scheduler scheduler;
+    Rewind rewind(1 << 20, 1000, 8); // Several keyframes and their deltas
+
+    const unsigned int FRAMES = 50;
+    vector<vector<uint8_t>> states;
+    vector<uint64_t> cycles, ticks;
+    for (unsigned int frame = 0; frame <= FRAMES; frame++)
+    {
+        states.push_back(State(chip8));
+        cycles.push_back(scheduler.cycles);
+        ticks.push_back(scheduler.timerTicks);
+        if (frame < FRAMES)
+        {
+            rewind.Push(chip8, scheduler);
+            scheduler.RunFrame(chip8);
+        }
+    }
+
+    bool matches = true;
+    for (unsigned int k = 1; k <= 20; k++)
+    {
+        matches = matches && rewind.Pop(chip8, scheduler) && State(chip8) == states[FRAMES - k]
+                          && scheduler.cycles == cycles[FRAMES - k] && scheduler.timerTicks == ticks[FRAMES - k];
+    }
+    Check(matches, "Each rewind step undoes one frame, emulated time included");
+
+    // Running on from there repeats the frames that were undone
+    for (unsigned int frame = FRAMES - 20; frame < FRAMES; frame++)
+    {
+        rewind.Push(chip8, scheduler);
+        scheduler.RunFrame(chip8);
+        matches = matches && State(chip8) == states[frame + 1] && scheduler.cycles == cycles[frame + 1];
+    }
+    Check(matches, "Frames run again after a rewind match the first time");
+
+    while (rewind.Pop(chip8, scheduler))
+    {
+    }
+    Check(State(chip8) == states[0] && scheduler.cycles == 0, "Rewinding everything restores the first state");
+}
+
+// A run recorded across a rewind, the way the window records it, replays to the same machine
+static void TestRecordAcrossRewind()
+{
+    const Chip8 start = Machine(QuirkProfile::MODERN, {
+        0xC0FF, 0xC10F, // Random V0, random key V1
+        0xE19E, 0x7201, // V2 counts the times key V1 is up
+        0xF307, 0x8234, // V2 += delay timer
+        0xF015, 0x1200 // Delay timer from V0
+    });
+
+    Chip8 chip8 = start;
+    Scheduler scheduler;
+    Rewind rewind;
+    Movie record;
+
+    // Play 100 frames, rewind 10, play 50 more with other keys
+    auto play = [&](unsigned int frames, unsigned int keys) {
+        for (unsigned int f = 0; f < frames; f++)
+        {
+            Movie::ApplyKeys(static_cast<uint16_t>(keys * (f + 1)), chip8.keypad);
+            record.frames.push_back(Movie::KeyMask(chip8.keypad));
+            rewind.Push(chip8, scheduler);
+            scheduler.RunFrame(chip8);
+        }
+    };
+    play(100, 0x1357);
+    for (unsigned int f = 0; f < 10; f++)
+    {
+        if (rewind.Pop(chip8, scheduler))
+        {
+            record.frames.pop_back();
+        }
+    }
+    play(50, 0x2468);
+
+    Chip8 replayed = start;
+    Scheduler replayScheduler;
+    for (uint16_t keys : record.frames)
+    {
+        Movie::ApplyKeys(keys, replayed.keypad);
+        replayScheduler.RunFrame(replayed);
+    }
+    Check(record.frames.size() == 140 && State(replayed) == State(chip8) && replayScheduler.cycles == scheduler.cycles,
+          "A movie recorded across a rewind replays to the same run");
+}
+
+// Code written through chip8_memory() runs, and states saved through the C interface restore machine and time
+static void TestCInterface()
+{
+    const char* path = "tests_c.ch8";
+    ofstream(path, ios::binary) << "\x60\x01\x12\x00"; // V0 = 1, jump back
+    chip8_machine* machine = chip8_create(path, "modern", "jit", 700, 60, 0);
+    remove(path);
+    if (!machine)
+    {
+        Check(false, chip8_last_error());
+        return;
+    }
+
+    chip8_run(machine, 4);
+    chip8_memory(machine)[0x201] = 0x42;
+    chip8_run(machine, 2);
+    Check(chip8_registers(machine)[0] == 0x42, "Code written through chip8_memory() is what runs next");
+
+    vector<uint8_t> state(chip8_state_size(machine));
+    Check(chip8_save_state(machine, state.data()) == 0, "chip8_save_state succeeds");
+    uint64_t cycles = chip8_cycles(machine);
+    chip8_memory(machine)[0x201] = 0x07;
+    chip8_run(machine, 100);
+    Check(chip8_load_state(machine, state.data(), state.size()) == 0 && chip8_cycles(machine) == cycles && chip8_memory(machine)[0x201] == 0x42,
+          "chip8_load_state restores memory and the scheduler's cycles");
+    chip8_run(machine, 2);
+    Check(chip8_registers(machine)[0] == 0x42, "Code restored by chip8_load_state is what runs next");
+    Check(chip8_load_state(machine, state.data(), state.size() - 1) == -1, "chip8_load_state refuses a truncated state");
+
+    chip8_destroy(machine);
+}
+
+int main()
+{
+    TestMemoryWraps();
+    TestLockstepWrappedStore();
+    TestStateSize();
+    TestResetRestoresMemory();
+    TestRomOutlivesItsFile();
+    TestRomRewrittenInPlace();
+    TestDirtyRows();
+    TestAudioRingWraps();
+    TestSuperChipScreen();
+    TestSuperChipRegisters();
+    TestQuirks();
+    TestJitCode();
+    TestEnv();
+    TestVecEnvAutoReset();
+    TestRewind();
+    TestRecordAcrossRewind();
+    TestCInterface();
+
+    cout << (failures ? "TESTS FAILED" : "All tests passed") << endl;
+    return failures ? EXIT_FAILURE : 0;
+}
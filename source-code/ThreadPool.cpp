@@ -0,0 +1,134 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+    if (threads == 0)
+    {
+        threads = max(thread::hardware_concurrency(), 1u);
+    }
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        queues.push_back(make_unique<Queue>());
+    }
+
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        workers.emplace_back(&ThreadPool::Worker, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(jobLock);
+        stopping = true;
+    }
+    jobReady.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const function<void(size_t)>& body)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    {
+        lock_guard<mutex> guard(jobLock);
+        this->body = &body;
+        remaining = count;
+
+        // Contiguous ranges per thread keep neighbouring tasks (and their data) on one core until stealing kicks in
+        size_t threads = queues.size();
+        for (size_t t = 0; t < threads; t++)
+        {
+            lock_guard<mutex> queueGuard(queues[t]->lock);
+            for (size_t i = count * t / threads; i < count * (t + 1) / threads; i++)
+            {
+                queues[t]->tasks.push_back(i);
+            }
+        }
+
+        job++;
+    }
+    jobReady.notify_all();
+
+    Drain(0);
+
+    // Stolen tasks may still be running on other threads
+    unique_lock<mutex> guard(jobLock);
+    jobDone.wait(guard, [this] { return remaining == 0; });
+}
+
+void ThreadPool::Worker(unsigned int id)
+{
+    uint64_t seen = 0;
+
+    while (true)
+    {
+        {
+            unique_lock<mutex> guard(jobLock);
+            jobReady.wait(guard, [&] { return stopping || job != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = job;
+        }
+
+        Drain(id);
+    }
+}
+
+bool ThreadPool::Pop(unsigned int id, size_t& task)
+{
+    // Own queue first, oldest task first
+    {
+        Queue& own = *queues[id];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Then steal the newest task of another thread, starting with the next one along
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        Queue& victim = *queues[(id + i) % queues.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::Drain(unsigned int id)
+{
+    size_t task;
+    while (Pop(id, task))
+    {
+        (*body)(task);
+
+        if (--remaining == 0)
+        {
+            lock_guard<mutex> guard(jobLock);
+            jobDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Fixed set of worker threads running parallel loops with work stealing.
+// Each thread owns a queue of task indices; it takes from the front of its own queue and,
+// once that is empty, steals from the back of the others, so uneven tasks still balance out.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threads = 0); // 0 uses every hardware thread
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Call body(i) for every i in [0, count) across all threads, the calling thread included.
+    // Returns once every call has finished. Not reentrant: body must not call ParallelFor on the same pool.
+    void ParallelFor(size_t count, const function<void(size_t)>& body);
+
+    unsigned int Size() const { return static_cast<unsigned int>(queues.size()); } // Threads taking part in a loop
+
+private:
+    struct Queue{
+        mutex lock;
+        deque<size_t> tasks;
+    };
+
+    void Worker(unsigned int id); // Loop of the thread owning queues[id]
+    bool Pop(unsigned int id, size_t& task); // Next task for thread id, its own or stolen
+    void Drain(unsigned int id); // Run tasks until none are left anywhere
+
+    vector<unique_ptr<Queue>> queues; // One per thread, queues[0] belongs to the caller of ParallelFor
+    vector<thread> workers; // Threads owning queues[1...]
+
+    const function<void(size_t)>* body{}; // Loop body of the current ParallelFor
+    atomic<size_t> remaining{}; // Tasks of the current loop not finished yet
+
+    mutex jobLock;
+    condition_variable jobReady; // Signalled when a loop starts or the pool stops
+    condition_variable jobDone; // Signalled when remaining drops to zero
+    uint64_t job{}; // Number of loops started, workers wake when it changes
+    bool stopping{};
+};
+
+#endif
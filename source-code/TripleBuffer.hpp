@@ -0,0 +1,45 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// Lock-free handoff of whole values (frames) from one producer thread to one consumer thread.
+// Of three slots the producer owns one (back), the consumer owns one (front) and the third (middle) is swapped
+// atomically between them: Publish() trades the filled back slot for the middle one, Acquire() trades the front
+// slot for the middle one when something newer was published. Neither side ever waits or sees a half-written
+// value, and the consumer always gets the latest published value; values it was too slow for are skipped.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : slots(3) {}
+
+    T& Back() { return slots[back]; } // Producer: the slot to fill before Publish()
+    void Publish() { back = middle.exchange(back | FRESH, memory_order_acq_rel) & INDEX; }
+
+    // Consumer: switch Front() to the newest published value, false (and Front() unchanged) when there is none
+    bool Acquire()
+    {
+        if (!(middle.load(memory_order_relaxed) & FRESH))
+        {
+            return false;
+        }
+        front = middle.exchange(front, memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& Front() const { return slots[front]; }
+
+private:
+    static const uint8_t INDEX = 0x3; // Slot number in middle
+    static const uint8_t FRESH = 0x4; // Set in middle when it holds a value the consumer has not taken
+
+    vector<T> slots;
+    uint8_t back{0}; // Producer only
+    uint8_t front{1}; // Consumer only
+    atomic<uint8_t> middle{2};
+};
+
+#endif
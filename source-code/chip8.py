@@ -0,0 +1,189 @@
+"""Python bindings for the emulator, through ctypes and libchip8.so (build it with `make libchip8.so`).
+
+memory, registers, keypad, stack and screen are ctypes arrays laid over the machine itself: they support the buffer
+protocol, so numpy.asarray(machine.screen) or memoryview(machine.memory).cast("B") are views, not copies, and writes through
+them reach the machine. Every call into the library releases the GIL, so Python threads driving different machines
+run in parallel.
+
+    machine = chip8.Chip8("../ROMs/Tetris.ch8", seed=1)
+    machine.keypad[5] = 1
+    machine.run_frames(60)
+    rows = numpy.asarray(machine.screen)  # (64, 2, 2) uint64, see Chip8C.h for the bit layout
+"""
+
+import ctypes
+import functools
+import os
+
+_library = ctypes.CDLL(os.environ.get("CHIP8_LIBRARY", os.path.join(os.path.dirname(os.path.abspath(__file__)), "libchip8.so")))
+
+MEMORY_SIZE = 0x10000
+SCREEN_HEIGHT = 64
+SCREEN_PLANES = 2
+SCREEN_WORDS = 2
+FRAME_WIDTH = 128
+FRAME_HEIGHT = 64
+
+_machine = ctypes.c_void_p
+_pool = ctypes.c_void_p
+
+
+def _declare(name, result, *arguments):
+    function = getattr(_library, name)
+    function.restype = result
+    function.argtypes = list(arguments)
+    return function
+
+
+_last_error = _declare("chip8_last_error", ctypes.c_char_p)
+_create = _declare("chip8_create", _machine, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint32)
+_clone = _declare("chip8_clone", _machine, _machine)
+_destroy = _declare("chip8_destroy", None, _machine)
+_reset = _declare("chip8_reset", ctypes.c_int, _machine)
+_seed = _declare("chip8_seed", ctypes.c_int, _machine, ctypes.c_uint32)
+_run = _declare("chip8_run", ctypes.c_int, _machine, ctypes.c_uint64)
+_run_frames = _declare("chip8_run_frames", ctypes.c_int, _machine, ctypes.c_uint32)
+_memory = _declare("chip8_memory", ctypes.POINTER(ctypes.c_uint8), _machine)
+_registers = _declare("chip8_registers", ctypes.POINTER(ctypes.c_uint8), _machine)
+_keypad = _declare("chip8_keypad", ctypes.POINTER(ctypes.c_uint8), _machine)
+_stack = _declare("chip8_stack", ctypes.POINTER(ctypes.c_uint16), _machine)
+_screen = _declare("chip8_screen", ctypes.POINTER(ctypes.c_uint64), _machine)
+_pc = _declare("chip8_pc", ctypes.c_uint16, _machine)
+_index = _declare("chip8_index", ctypes.c_uint16, _machine)
+_sp = _declare("chip8_sp", ctypes.c_uint8, _machine)
+_delay_timer = _declare("chip8_delay_timer", ctypes.c_uint8, _machine)
+_sound_timer = _declare("chip8_sound_timer", ctypes.c_uint8, _machine)
+_hires = _declare("chip8_hires", ctypes.c_int, _machine)
+_cycles = _declare("chip8_cycles", ctypes.c_uint64, _machine)
+_screen_hash = _declare("chip8_screen_hash", ctypes.c_uint64, _machine)
+_render = _declare("chip8_render", ctypes.c_int, _machine, ctypes.c_void_p)
+_state_size = _declare("chip8_state_size", ctypes.c_size_t, _machine)
+_save_state = _declare("chip8_save_state", ctypes.c_int, _machine, ctypes.c_void_p)
+_load_state = _declare("chip8_load_state", ctypes.c_int, _machine, ctypes.c_void_p, ctypes.c_size_t)
+_pool_create = _declare("chip8_pool_create", _pool, ctypes.c_uint)
+_pool_destroy = _declare("chip8_pool_destroy", None, _pool)
+_run_batch = _declare("chip8_run_batch", ctypes.c_int, _pool, ctypes.POINTER(_machine), ctypes.c_size_t, ctypes.c_uint64)
+
+
+def _check(result):
+    if result is None or result == -1:
+        raise RuntimeError(_last_error().decode())
+    return result
+
+
+class _Machine:
+    """Owner of a native machine, destroying it once neither its Chip8 nor any view over it is left"""
+
+    def __init__(self, handle):
+        self.handle = handle
+
+    def __del__(self):
+        _destroy(self.handle)
+
+
+def _view(owner, pointer, element, *shape):
+    """ctypes array of shape over the memory at pointer, no copy, keeping owner alive as long as it is"""
+    array = element
+    for length in reversed(shape):
+        array = array * length
+    view = array.from_address(ctypes.addressof(pointer.contents))
+    view._owner = owner
+    return view
+
+
+class Chip8:
+    """One machine running a ROM, driven on emulated time like the Scheduler"""
+
+    def __init__(self, rom, quirks="modern", engine="interpreter", cpu_hz=700, timer_hz=60, seed=0, _handle=None):
+        handle = _handle if _handle is not None else _check(_create(os.fsencode(rom), quirks.encode(), engine.encode(), cpu_hz, timer_hz, seed))
+        self._machine = _Machine(handle)
+        self._handle = handle
+
+    # Views are made on first use and hold the _Machine, not the Chip8, so neither keeps the other in a cycle
+    @functools.cached_property
+    def memory(self):
+        return _view(self._machine, _memory(self._handle), ctypes.c_uint8, MEMORY_SIZE)
+
+    @functools.cached_property
+    def registers(self):
+        return _view(self._machine, _registers(self._handle), ctypes.c_uint8, 16)
+
+    @functools.cached_property
+    def keypad(self):
+        return _view(self._machine, _keypad(self._handle), ctypes.c_uint8, 16)
+
+    @functools.cached_property
+    def stack(self):
+        return _view(self._machine, _stack(self._handle), ctypes.c_uint16, 16)
+
+    @functools.cached_property
+    def screen(self):
+        return _view(self._machine, _screen(self._handle), ctypes.c_uint64, SCREEN_HEIGHT, SCREEN_PLANES, SCREEN_WORDS)
+
+    def clone(self):
+        """Independent copy in the same state"""
+        return Chip8(None, _handle=_check(_clone(self._handle)))
+
+    def reset(self):
+        _check(_reset(self._handle))
+
+    def seed(self, seed):
+        _check(_seed(self._handle, seed))
+
+    def run(self, instructions):
+        _check(_run(self._handle, instructions))
+
+    def run_frames(self, frames):
+        _check(_run_frames(self._handle, frames))
+
+    pc = property(lambda self: _pc(self._handle))
+    index = property(lambda self: _index(self._handle))
+    sp = property(lambda self: _sp(self._handle))
+    delay_timer = property(lambda self: _delay_timer(self._handle))
+    sound_timer = property(lambda self: _sound_timer(self._handle))
+    hires = property(lambda self: bool(_hires(self._handle)))
+    cycles = property(lambda self: _cycles(self._handle))
+
+    def screen_hash(self):
+        return _screen_hash(self._handle)
+
+    def render(self, pixels=None):
+        """FRAME_WIDTH * FRAME_HEIGHT RGBA pixels as uint32, written into pixels (any writable buffer) when given"""
+        if pixels is None:
+            pixels = (ctypes.c_uint32 * (FRAME_WIDTH * FRAME_HEIGHT))()
+        _check(_render(self._handle, _address(pixels, FRAME_WIDTH * FRAME_HEIGHT * 4)))
+        return pixels
+
+    def save_state(self):
+        state = bytearray(_state_size(self._handle))
+        _check(_save_state(self._handle, _address(state, len(state))))
+        return bytes(state)
+
+    def load_state(self, state):
+        buffer = (ctypes.c_uint8 * len(state)).from_buffer_copy(state)
+        _check(_load_state(self._handle, buffer, len(state)))
+
+
+def _address(buffer, size):
+    """Address of a writable buffer of at least size bytes"""
+    view = memoryview(buffer).cast("B")
+    if view.readonly or view.nbytes < size:
+        raise ValueError("buffer must be writable and at least %d bytes" % size)
+    return ctypes.addressof(ctypes.c_uint8.from_buffer(view))
+
+
+class Pool:
+    """Worker threads running many machines at once"""
+
+    def __init__(self, threads=0):
+        self._handle = _check(_pool_create(threads))
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            _pool_destroy(self._handle)
+            self._handle = None
+
+    def run(self, machines, instructions):
+        """Run instructions on every machine (all distinct) in parallel"""
+        handles = (_machine * len(machines))(*[machine._handle for machine in machines])
+        _check(_run_batch(self._handle, handles, len(machines), instructions))
@@ -1,19 +1,37 @@
 #include "Chip8.hpp"
 #include "Platform.hpp"
+#include "Scheduler.hpp"
+#include "Rewind.hpp"
+#include "Movie.hpp"
+#include "Audio.hpp"
+#include "TripleBuffer.hpp"
 #include <iostream>
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <memory>
+#include <cstring>
 #include <SDL2/SDL.h>
 using namespace std;
 
+const unsigned int FRAME_RATE = 60; // Frames presented per second, also the timer rate
+
+// A completed frame, handed from the emulation thread to the render thread
+struct Frame{
+    uint32_t pixels[HIRES_WIDTH * HIRES_HEIGHT]; // RGBA copy of the packed screen, always at high resolution
+    uint64_t dirtyRows; // Rows that differ from the previous frame
+    uint64_t sequence; // Frames published before this one, plus one
+};
+
 int main(int inputSize, char** input)
 {
     // Check for correct command to run the executable with sufficient arguments
-    if (inputSize != 4)
+    if (inputSize < 4)
     {
         cout<<"ENTER THE ROM IN PROPER FORMAT"<<endl;
-        cout << "FORMAT OF USE: " << input[0] << " <Scale> <Delay> <ROM>\n";
+        cout << "FORMAT OF USE: " << input[0] << " <Scale> <Delay> <ROM> [--ipf <InstructionsPerFrame>] [--quirks modern|vip|schip|xochip] [--seed <Seed>]"
+             << " [--record <Movie>] [--replay <Movie>]\n";
         exit(EXIT_FAILURE);
     }
 
@@ -21,50 +39,246 @@ int main(int inputSize, char** input)
     int cycleDelay = stoi(input[2]);
     char const* ROM = input[3];
 
+    // Without --ipf, <Delay> milliseconds per instruction sets the CPU speed as before
+    unsigned int cpuHz = cycleDelay > 0 ? 1000 / cycleDelay : 1000;
+
+    // Without --seed every run gets different random numbers, recorded in the movie if there is one
+    uint32_t seed = static_cast<uint32_t>(chrono::steady_clock::now().time_since_epoch().count());
+    QuirkProfile quirks = QuirkProfile::MODERN;
+    const char* recordFile = nullptr;
+    const char* replayFile = nullptr;
+
+    for (int i = 4; i < inputSize; i++)
+    {
+        if (i + 1 >= inputSize)
+        {
+            cout << "INCOMPLETE OPTION: " << input[i] << endl;
+            exit(EXIT_FAILURE);
+        }
+
+        if (strcmp(input[i], "--ipf") == 0) cpuHz = stoi(input[++i]) * FRAME_RATE;
+        else if (strcmp(input[i], "--seed") == 0) seed = stoul(input[++i]);
+        else if (strcmp(input[i], "--quirks") == 0)
+        {
+            try{
+                quirks = QuirkProfileNamed(input[++i]);
+            }
+            catch (const char* e)
+            {
+                cout << e << ": " << input[i] << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(input[i], "--record") == 0) recordFile = input[++i];
+        else if (strcmp(input[i], "--replay") == 0) replayFile = input[++i];
+        else
+        {
+            cout << "UNKNOWN OPTION: " << input[i] << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sound of the emulator, declared before the screen so it outlives the audio device playing it
+    Audio audio(48000, FRAME_RATE);
+
     // Instantiate SDL2 based graphical screen
-    Platform screen("CHIP-8 Emulator", VIDEO_WIDTH * videoScaling, VIDEO_HEIGHT * videoScaling, VIDEO_WIDTH, VIDEO_HEIGHT);
+    Platform screen("CHIP-8 Emulator", VIDEO_WIDTH * videoScaling, VIDEO_HEIGHT * videoScaling, HIRES_WIDTH, HIRES_HEIGHT);
 
     // Instantiate Chip-8 Emulation Engine 
     Chip8 chip8;
 
-    // Load the ROM
-    chip8.LoadROM(ROM);
+    Movie replay; // Input played back before handing over to the keyboard
+    Movie record; // Input of this run, saved on exit
+    size_t replayFrame = 0;
+
+    try{
+        // Load the ROM
+        chip8.LoadROM(ROM);
+
+        if (replayFile)
+        {
+            // Same seed and speed as the recording, so the run repeats bit for bit
+            replay.Load(replayFile);
+            if (replay.romHash != Movie::HashROM(ROM))
+            {
+                throw "The movie was recorded with a different ROM";
+            }
+            if (replay.timerHz != FRAME_RATE)
+            {
+                throw "The movie was recorded with timers at another rate than the 60 Hz frames of this window";
+            }
+            seed = replay.seed;
+            quirks = replay.quirks;
+            cpuHz = replay.cpuHz;
+        }
+
+        record.seed = seed;
+        record.cpuHz = cpuHz;
+        record.timerHz = FRAME_RATE;
+        record.romHash = recordFile ? Movie::HashROM(ROM) : 0;
+        record.quirks = quirks;
+    }
+    catch (const char* e)
+    {
+        cout<<"AN ERROR OCCURRED !!!!!!!!!!!!"<<endl;
+        cout << e << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    chip8.Seed(seed);
+    chip8.SetQuirks(quirks);
+
+    // CPU at cpuHz, timers at 60 Hz of emulated time, one timer period per frame
+    Scheduler scheduler(cpuHz, FRAME_RATE);
 
     // Specify the bytes occupied by a single row of display (size of one pixel multiplied by Width)
-    int videoPitch = sizeof(chip8.screen[0]) * VIDEO_WIDTH;
+    int videoPitch = sizeof(uint32_t) * HIRES_WIDTH;
 
-    auto lastCycleTime = chrono::high_resolution_clock::now(); // Starting time
-    bool quit = false; // variable to check if the exit condition is true
+    const auto framePeriod = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / FRAME_RATE));
 
-    try{
-        // Run the emulation cycles in loop until exit condition becomes true
-        while(!quit)
-        {
-            // Register key input
-            quit = screen.ProcessInput(chip8.keypad);
+    Rewind rewind; // Recent frames, stepped back through while Backspace is held
 
-            auto currentTime = chrono::high_resolution_clock::now();
+    if (!screen.StartAudio(audio))
+    {
+        cout << "No audio device, running silent: " << SDL_GetError() << endl;
+    }
+
+    // Everything the two threads share: frames go to the render thread, input comes back as snapshots
+    auto frames = make_unique<TripleBuffer<Frame>>();
+    atomic<uint16_t> keySnapshot{0}; // Movie::KeyMask of the keys held
+    atomic<bool> rewindHeld{false};
+    atomic<bool> quit{false}; // Set by either thread, both stop
 
-            // Variable to store elapsed time between last cycle and this one
-            float dt = chrono::duration<float, chrono::milliseconds::period>(currentTime - lastCycleTime).count();
+    // Emulation thread: runs the machine at its scheduled rate and never touches SDL, so a stalled present cannot slow it
+    thread emulation([&]{
+        auto nextFrame = chrono::steady_clock::now(); // Deadline of the current frame
+        uint64_t published = 0;
 
-            if (dt > cycleDelay)
+        try{
+            // Run one frame per iteration until exit condition becomes true
+            while(!quit.load(memory_order_relaxed))
             {
-                // Update the last cycle time to current time
-                lastCycleTime = currentTime;
+                bool replaying = replayFrame < replay.frames.size();
+
+                if (replaying)
+                {
+                    // The movie's keys replace the keyboard, and frames run back to back without pacing
+                    record.frames.push_back(replay.frames[replayFrame]);
+                    Movie::ApplyKeys(replay.frames[replayFrame++], chip8.keypad);
+                    rewind.Push(chip8, scheduler);
+                    scheduler.RunFrame(chip8);
+
+                    if (replayFrame == replay.frames.size())
+                    {
+                        cout << "Replay finished, screen hash " << hex << chip8.ScreenHash() << dec << endl;
+                        nextFrame = chrono::steady_clock::now();
+                    }
+                }
+                else if (rewindHeld.load(memory_order_relaxed))
+                {
+                    // Step one frame back, keeping the keys as they are held now rather than as they were then
+                    if (rewind.Pop(chip8, scheduler) && !record.frames.empty())
+                    {
+                        record.frames.pop_back(); // The recording forgets the undone frame too
+                    }
+                    Movie::ApplyKeys(keySnapshot.load(memory_order_relaxed), chip8.keypad);
+                }
+                else
+                {
+                    // Execute one frame worth of instructions and one timer tick
+                    Movie::ApplyKeys(keySnapshot.load(memory_order_relaxed), chip8.keypad);
+                    record.frames.push_back(Movie::KeyMask(chip8.keypad));
+                    rewind.Push(chip8, scheduler);
+                    scheduler.RunFrame(chip8);
+                }
 
-                // Execute the emulation cycle
-                chip8.Cycle();
+                // One frame of sound for the state the frame ended in, never waiting on the audio thread
+                audio.Generate(chip8);
 
-                // Update the display
-                screen.Update(chip8.screen, videoPitch);
+                // Hand a changed screen over to the render thread
+                if (chip8.screenDirty)
+                {
+                    Frame& frame = frames->Back();
+                    chip8.RenderScreen(frame.pixels);
+                    frame.dirtyRows = chip8.dirtyRows;
+                    frame.sequence = ++published;
+                    frames->Publish();
+
+                    chip8.screenDirty = false;
+                    chip8.dirtyRows = 0;
+                }
+
+                if (replaying)
+                {
+                    continue;
+                }
+
+                // Sleep until the next frame is due instead of spinning
+                nextFrame += framePeriod;
+                auto currentTime = chrono::steady_clock::now();
+
+                if (nextFrame > currentTime)
+                {
+                    this_thread::sleep_until(nextFrame);
+                }
+                else if (currentTime - nextFrame > framePeriod * 4)
+                {
+                    // Far behind (window dragged, debugger...), drop the missed frames rather than racing to catch up
+                    nextFrame = currentTime;
+                }
             }
         }
+        catch (const char* e)
+        {   
+            cout<<"AN ERROR OCCURRED !!!!!!!!!!!!"<<endl;
+            cout << e << endl;
+        }
+
+        quit.store(true, memory_order_relaxed);
+    });
+
+    // Render thread, this one since SDL wants its window and events on the main thread: input in, latest frame out
+    uint8_t keys[16]{};
+    uint64_t presented = 0; // Sequence of the frame on screen
+
+    while (!quit.load(memory_order_relaxed))
+    {
+        if (screen.ProcessInput(keys))
+        {
+            quit.store(true, memory_order_relaxed);
+        }
+        keySnapshot.store(Movie::KeyMask(keys), memory_order_relaxed);
+        rewindHeld.store(screen.RewindHeld(), memory_order_relaxed);
+
+        if (frames->Acquire())
+        {
+            // Upload only the rows the frame changed, or everything when frames in between were skipped
+            const Frame& frame = frames->Front();
+            screen.Update(frame.pixels, videoPitch, frame.sequence == presented + 1 ? frame.dirtyRows : ~0ull);
+            presented = frame.sequence;
+        }
+        else
+        {
+            SDL_Delay(1); // Nothing new to show yet
+        }
     }
-    catch (const char* e)
-    {   
-        cout<<"AN ERROR OCCURRED !!!!!!!!!!!!"<<endl;
-        cout << e << endl;
+
+    emulation.join();
+
+    Audio::Stats stats = audio.GetStats();
+    cout << "Audio: " << stats.underruns << " underruns, " << stats.droppedSamples << " samples dropped, latency "
+         << stats.latencyMs << " ms (at most " << stats.maxLatencyMs << " ms)" << endl;
+
+    if (recordFile)
+    {
+        try{
+            record.Save(recordFile);
+        }
+        catch (const char* e)
+        {
+            cout<<"AN ERROR OCCURRED !!!!!!!!!!!!"<<endl;
+            cout << e << endl;
+        }
     }
 
 